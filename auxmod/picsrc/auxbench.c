@@ -0,0 +1,124 @@
+/*****************************************************************************\
+ *  Copyright (C) 2012 Jim Garlick
+ *
+ *  This file is part of ultima8drivecorrector, replacement base electronics
+ *  for the Celestron Ultima 8 telescope.  For details, see
+ *  <http://code.google.com/p/ultima8drivecorrector>.
+ *
+ *  ultima8drivecorrector is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ultima8drivecorrector is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ *  Public License *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ultima8drivecorrector; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* auxbench.c - find the maximum encoder edge rate main.c can count */
+
+/* Runs the bench firmware image in gpsim with quadrature waveforms on all
+ * three encoders (RA and focus forward, DEC reverse, edges interleaved).
+ * The bench image (make bench.cof) feeds i2c_interrupt () the MSSP states
+ * of a master polling all three encoder registers back to back on a
+ * 400 kHz bus (see bench_interrupt).
+ * At checkpoints the low bytes of enc_ra, enc_dec and enc_focus are
+ * compared with the number of edges sent, and enc_illegal must be zero.
+ * The edge rate is raised until the counts diverge.  The gpsim driver is
+ * shared with encbench (see hotspot/picsrc/gpbench.c).  With -b, exit
+ * nonzero if the rate found is below the given baseline.
+ *
+ * cc -I../../hotspot/picsrc -o auxbench auxbench.c \
+ *     ../../hotspot/picsrc/gpbench.c
+ * ./auxbench [-v] [-r start-rate] [-m max-rate] [-t seconds] [-b baseline]
+ *            cof
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "gpbench.h"
+
+#define SETTLE_TIME     0.01        /* seconds for init */
+
+/* RA and focus forward, DEC reverse (see ENC_RA () etc in main.c) */
+static const gpb_enc_t enc[] = {
+    { "porta3", "portb7", "_enc_ra", 1 },
+    { "porta5", "porta4", "_enc_dec", -1 },
+    { "portb5", "porta2", "_enc_focus", 1 },
+};
+
+static const gpb_bench_t bench = {
+    .name           = "auxbench",
+    .enc            = enc,
+    .nenc           = 3,
+    .illegal_var    = "_enc_illegal",
+    .settle         = SETTLE_TIME,
+    .extra          = NULL,
+};
+
+void
+usage (void)
+{
+    fprintf (stderr,
+"Usage: auxbench [-v] [-r start-rate] [-m max-rate] [-t sec] [-b baseline]\n"
+"                cof\n"
+    );
+    exit (1);
+}
+
+int
+main (int argc, char *argv[])
+{
+    double rate = 1000;         /* edges/s per encoder */
+    double max_rate = 500000;
+    double sec = 0.1;
+    double baseline = 0;
+    double good;
+    int verbose = 0;
+    int c;
+
+    while ((c = getopt (argc, argv, "vr:m:t:b:")) != -1) {
+        switch (c) {
+            case 'v':
+                verbose = 1;
+                break;
+            case 'r':
+                rate = strtod (optarg, NULL);
+                break;
+            case 'm':
+                max_rate = strtod (optarg, NULL);
+                break;
+            case 't':
+                sec = strtod (optarg, NULL);
+                break;
+            case 'b':
+                baseline = strtod (optarg, NULL);
+                break;
+            default:
+                usage ();
+        }
+    }
+    if (optind != argc - 1 || rate <= 0 || sec <= 0)
+        usage ();
+
+    good = gpb_search (&bench, argv[optind], rate, max_rate, sec, verbose);
+    printf ("max sustainable edge rate: %.0f edges/s per encoder"
+            " (all three, continuous I2C polls)\n", good);
+    if (good < baseline) {
+        fprintf (stderr, "auxbench: below baseline of %.0f edges/s\n",
+                 baseline);
+        exit (1);
+    }
+    exit (0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
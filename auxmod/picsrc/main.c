@@ -0,0 +1,548 @@
+/*****************************************************************************\
+ *  Copyright (C) 2012 Jim Garlick
+ *
+ *  This file is part of ultima8drivecorrector, replacement base electronics
+ *  for the Celestron Ultima 8 telescope.  For details, see
+ *  <http://code.google.com/p/ultima8drivecorrector>.
+ *
+ *  ultima8drivecorrector is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ultima8drivecorrector is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ *  Public License *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ultima8drivecorrector; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* main.c - firmware for the Ultima 8 aux encoder/focuser module */
+
+/* NOTE: compiled with hi-tech C pro V9.80 */
+
+#include <htc.h>
+#include "i2c_slave.h"
+
+#define _XTAL_FREQ 64000000
+
+#if defined(_18F14K22)
+__CONFIG (1, FOSC_IRC & PLLEN_ON);  /* system clock is HFOSC*4 */
+__CONFIG (2, BOREN_SBORDIS & BORV_27 & WDTEN_ON & WDTPS_256); /* ~1s WDT */
+__CONFIG (3, HFOFST_OFF & MCLRE_OFF); /* RA3 is an encoder input */
+__CONFIG (4, LVP_OFF);
+#else
+#error code assumes 18F14K22 chip.
+#endif
+
+#define I2C_ADDR        9       /* base is 8 */
+
+/* Pin assignments (see schem/aux.png).
+ * Encoder phases are in interrupt-on-change ports A and B.
+ */
+#define FOCIN           PORTCbits.RC2
+#define FOCOUT          PORTCbits.RC1
+
+#define ENC_RA(a,b)     ((((a) >> 3) & 1) | (((b) >> 6) & 2))  /* RA3,RB7 */
+#define ENC_DEC(a,b)    ((((a) >> 5) & 1) | (((a) >> 3) & 2))  /* RA5,RA4 */
+#define ENC_FOCUS(a,b)  ((((b) >> 5) & 1) | (((a) >> 1) & 2))  /* RB5,RA2 */
+
+/* Quadrature decode: step for each (old<<2 | new) pair of phase states,
+ * phase A in bit 0.  A,B = 00,01,11,10 counts up.  Both phases changing
+ * means an edge was missed; it is counted and the position is not moved.
+ */
+#define ENC_ILLEGAL     2
+static const signed char enc_step[16] = {
+    0, 1, -1, ENC_ILLEGAL,
+    -1, 0, ENC_ILLEGAL, 1,
+    1, ENC_ILLEGAL, 0, -1,
+    ENC_ILLEGAL, -1, 1, 0,
+};
+
+static volatile int enc_ra = 0;
+static volatile int enc_dec = 0;
+static volatile int enc_focus = 0;
+static volatile UINT16 enc_illegal = 0;
+
+#define ENC_UPDATE(count,old,new) do { \
+    signed char _s = enc_step[((old) << 2) | (new)]; \
+    if (_s == ENC_ILLEGAL) \
+        enc_illegal++; \
+    else \
+        (count) += _s; \
+} while (0)
+
+/* Called on any encoder pin change.  Reading both ports ends the
+ * mismatch; a pin that changes after the read sets RABIF again.
+ */
+void
+enc_interrupt (void)
+{
+    static unsigned char ra = 0, dec = 0, focus = 0;
+    unsigned char a = PORTA;
+    unsigned char b = PORTB;
+    unsigned char new;
+
+    new = ENC_RA (a, b);
+    if (new != ra) {
+        ENC_UPDATE (enc_ra, ra, new);
+        ra = new;
+    }
+    new = ENC_DEC (a, b);
+    if (new != dec) {
+        ENC_UPDATE (enc_dec, dec, new);
+        dec = new;
+    }
+    new = ENC_FOCUS (a, b);
+    if (new != focus) {
+        ENC_UPDATE (enc_focus, focus, new);
+        focus = new;
+    }
+}
+
+void
+enc_init (void)
+{
+    TRISAbits.RA2 = 1;          /* inputs */
+    TRISAbits.RA3 = 1;
+    TRISAbits.RA4 = 1;
+    TRISAbits.RA5 = 1;
+    TRISBbits.RB5 = 1;
+    TRISBbits.RB7 = 1;
+
+    RABPU = 0;                  /* enable weak pullups feature */
+    WPUAbits.WPUA2 = 1;
+    WPUAbits.WPUA3 = 1;
+    WPUAbits.WPUA4 = 1;
+    WPUAbits.WPUA5 = 1;
+    WPUBbits.WPUB5 = 1;
+    WPUBbits.WPUB7 = 1;
+
+    IOCAbits.IOCA2 = 1;         /* interrupt on change */
+    IOCAbits.IOCA3 = 1;
+    IOCAbits.IOCA4 = 1;
+    IOCAbits.IOCA5 = 1;
+    IOCBbits.IOCB5 = 1;
+    IOCBbits.IOCB7 = 1;
+
+    enc_interrupt ();           /* sample initial phase states */
+    enc_illegal = 0;
+    INTCONbits.RABIF = 0;
+    INTCONbits.RABIE = 1;
+}
+
+/* Focus motor: FOCIN/FOCOUT select direction on the H-bridge inputs and
+ * P1A (RC5) PWMs its enable.  PR2 = 254 makes the 10-bit duty for PWM
+ * value v exactly v/255, so 255 is fully on; the period is 15.7 kHz.
+ * The postscaled Timer2 interrupt paces closed loop focus.
+ */
+#define FOCUS_PR2       254
+#define FOCUS_T2CKPS    1       /* 1:4 */
+#define FOCUS_TOUTPS    15      /* 1:16, focus_tics at 980 Hz */
+#define CCP1CON_PWM     0x0c    /* single output, P1A active high */
+
+typedef enum { FOC_OFF=0, FOC_IN=1, FOC_OUT=2 } focus_t;
+
+static focus_t focus_dir = FOC_OFF;
+static unsigned char focus_pwm = 0;
+
+void
+focus_set (focus_t dir, unsigned char pwm)
+{
+    switch (dir) {
+        case FOC_IN:
+            FOCOUT = 0;
+            NOP ();
+            FOCIN = 1;
+            break;
+        case FOC_OUT:
+            FOCIN = 0;
+            NOP ();
+            FOCOUT = 1;
+            break;
+        default:
+            dir = FOC_OFF;
+            pwm = 0;
+            FOCIN = 0;
+            NOP ();
+            FOCOUT = 0;
+            break;
+    }
+    CCPR1L = pwm;
+    focus_dir = dir;
+    focus_pwm = pwm;
+}
+
+void
+focus_init (void)
+{
+    FOCIN = 0;
+    FOCOUT = 0;
+    T2CONbits.T2CKPS = FOCUS_T2CKPS;
+    T2CONbits.TOUTPS = FOCUS_TOUTPS;
+    PR2 = FOCUS_PR2;
+    TMR2 = 0;
+    CCPR1L = 0;
+    CCP1CON = CCP1CON_PWM;      /* DC1B = 0 */
+    TMR2IF = 0;
+    TMR2IE = 1;                 /* focus_tics */
+    TMR2ON = 1;
+}
+
+/* Closed loop focus.  Writing focus-target starts a move to that
+ * absolute focus-enc position; writing focus-motor returns to manual.
+ * Every move ends travelling OUT (counts increasing), so gear backlash
+ * is always taken up the same way.  The final approach starts at least
+ * focus-backlash + focus-decel counts below the target, backing off
+ * first if need be, so it always takes up the backlash and then runs
+ * the whole deceleration.  Each leg runs at full PWM until within
+ * focus-decel counts of its end, then slows in proportion to the
+ * distance left.  Since every approach arrives the same way, it can cut
+ * the motor focus_coast counts early, learned from where past approaches
+ * came to rest.  At the end of a leg the motor is stopped and the
+ * encoder must be still for FOCUS_QUIET_TICS.  A move that ends outside
+ * FOCUS_TOLERANCE is retried; one that stalls or runs out of retries
+ * fails.
+ * focus_poll () runs in the main loop on each Timer2 postscaler tick.
+ */
+#define FOCUS_PWM_MIN       64  /* slowest approach that still turns */
+#define FOCUS_QUIET_TICS    50
+#define FOCUS_STALL_TICS    500
+#define FOCUS_TOLERANCE     1
+#define FOCUS_TRIES         3
+
+typedef enum {
+    FOCUS_MANUAL=0, FOCUS_MOVING=1, FOCUS_SETTLED=2, FOCUS_FAILED=3
+} focus_mode_t;
+typedef enum { LEG_BACKOFF, LEG_PAUSE, LEG_APPROACH, LEG_SETTLE } focus_leg_t;
+
+static volatile focus_mode_t focus_mode = FOCUS_MANUAL;
+static volatile int focus_target = 0;
+static volatile unsigned char focus_start = 0;  /* new target written */
+static volatile unsigned char focus_tics = 0;
+static volatile UINT16 focus_backlash = 50;
+static volatile UINT16 focus_decel = 200;
+static unsigned char focus_tries = 0;
+static int focus_coast = 0;
+
+static int
+focus_position (void)
+{
+    int pos;
+
+    INTCONbits.RABIE = 0;
+    pos = enc_focus;
+    INTCONbits.RABIE = 1;
+    return pos;
+}
+
+static int
+focus_runup (void)
+{
+    return (int)(focus_backlash + focus_decel);
+}
+
+/* Motor PWM for dist counts left in a leg.
+ */
+static unsigned char
+focus_speed (int dist)
+{
+    if (dist >= (int)focus_decel)
+        return 255;
+    return FOCUS_PWM_MIN
+         + (unsigned char)((255L - FOCUS_PWM_MIN) * dist / focus_decel);
+}
+
+void
+focus_poll (void)
+{
+    static focus_leg_t leg;
+    static int aim, last;
+    static UINT16 quiet;
+    focus_t dir = FOC_OFF;
+    unsigned char pwm = 0;
+    focus_mode_t mode = FOCUS_MOVING;
+    int pos = focus_position ();
+    int target;
+
+    SSPIE = 0;
+    if (focus_mode != FOCUS_MOVING) {
+        SSPIE = 1;
+        return;
+    }
+    if (focus_start) {
+        focus_start = 0;
+        focus_tries = 0;
+        leg = LEG_SETTLE;       /* begin from the settled check */
+        quiet = FOCUS_QUIET_TICS;
+    }
+    target = focus_target;
+    SSPIE = 1;
+
+    quiet = (pos == last) ? quiet + 1 : 0;
+    last = pos;
+    switch (leg) {
+        case LEG_BACKOFF:
+            if (pos > aim) {
+                dir = FOC_IN;
+                pwm = focus_speed (pos - aim);
+            } else {
+                leg = LEG_PAUSE;
+                quiet = 0;
+            }
+            break;
+        case LEG_PAUSE:         /* let the motor stop before reversing */
+            if (quiet >= FOCUS_QUIET_TICS) {
+                leg = LEG_APPROACH;
+                aim = target;
+                quiet = 0;
+            }
+            break;
+        case LEG_APPROACH:
+            if (pos < aim - focus_coast) {
+                dir = FOC_OUT;
+                pwm = focus_speed (aim - pos);
+            } else {
+                leg = LEG_SETTLE;
+                quiet = 0;
+            }
+            break;
+        case LEG_SETTLE:
+            if (quiet < FOCUS_QUIET_TICS)
+                break;
+            if (focus_tries > 0) {
+                focus_coast += pos - aim;
+                if (focus_coast < 0)
+                    focus_coast = 0;
+            }
+            if (pos >= target - FOCUS_TOLERANCE
+                                    && pos <= target + FOCUS_TOLERANCE
+                                    && focus_tries > 0) {
+                mode = FOCUS_SETTLED;
+            } else if (focus_tries++ == FOCUS_TRIES) {
+                mode = FOCUS_FAILED;
+            } else if (pos <= target - focus_runup ()) {
+                leg = LEG_APPROACH;
+                aim = target;
+            } else {
+                leg = LEG_BACKOFF;
+                aim = target - focus_runup ();
+            }
+            quiet = 0;
+            break;
+    }
+    if (dir != FOC_OFF && quiet >= FOCUS_STALL_TICS) {
+        dir = FOC_OFF;          /* driving but not moving: end stop? */
+        mode = FOCUS_FAILED;
+    }
+
+    SSPIE = 0;
+    if (focus_mode == FOCUS_MOVING && !focus_start) {
+        focus_set (dir, pwm);
+        focus_mode = mode;
+    }
+    SSPIE = 1;
+}
+
+/* I2C registers.  Each encoder count is latched with the others when a
+ * read starts, so its two bytes (and a burst of all three) are coherent.
+ */
+typedef enum {
+    REG_RA_ENC=0, REG_DEC_ENC=1, REG_FOCUS_ENC=2, REG_FOCUS_MOTOR=3,
+    REG_ENC_ILLEGAL=4, REG_FOCUS_TARGET=5, REG_FOCUS_STATUS=6,
+    REG_FOCUS_BACKLASH=7, REG_FOCUS_DECEL=8,
+    REG_COUNT
+} i2c_reg_t;
+static UINT16 reg_snap[REG_COUNT];
+
+/* Called from i2c_interrupt ().  An encoder count is replaced only when
+ * its MSB arrives.
+ */
+void
+reg_set (unsigned char regnum, unsigned char val, regbyte_t sel)
+{
+    static unsigned char lsb;
+    UINT16 v = ((UINT16)val << 8) | lsb;
+
+    if (sel == REG_LSB) {
+        lsb = val;
+        return;
+    }
+    switch (regnum) {
+        case REG_RA_ENC:
+            enc_ra = v;
+            break;
+        case REG_DEC_ENC:
+            enc_dec = v;
+            break;
+        case REG_FOCUS_ENC:
+            enc_focus = v;
+            break;
+        case REG_FOCUS_MOTOR:
+            focus_mode = FOCUS_MANUAL;
+            focus_set (lsb, val);
+            break;
+        case REG_ENC_ILLEGAL:
+            enc_illegal = v;
+            break;
+        case REG_FOCUS_TARGET:
+            focus_target = v;
+            focus_start = 1;
+            focus_mode = FOCUS_MOVING;
+            break;
+        case REG_FOCUS_BACKLASH:
+            focus_backlash = v;
+            break;
+        case REG_FOCUS_DECEL:
+            if (v > 0)
+                focus_decel = v;
+            break;
+    }
+}
+
+/* Called by i2c_interrupt () when a read starts, with interrupts off.
+ */
+void
+reg_snapshot (unsigned char first)
+{
+    reg_snap[REG_RA_ENC] = enc_ra;
+    reg_snap[REG_DEC_ENC] = enc_dec;
+    reg_snap[REG_FOCUS_ENC] = enc_focus;
+    reg_snap[REG_FOCUS_MOTOR] = ((UINT16)focus_pwm << 8) | focus_dir;
+    reg_snap[REG_ENC_ILLEGAL] = enc_illegal;
+    reg_snap[REG_FOCUS_TARGET] = focus_target;
+    reg_snap[REG_FOCUS_STATUS] = ((UINT16)focus_tries << 8) | focus_mode;
+    reg_snap[REG_FOCUS_BACKLASH] = focus_backlash;
+    reg_snap[REG_FOCUS_DECEL] = focus_decel;
+}
+
+unsigned char
+reg_get (unsigned char regnum, regbyte_t sel)
+{
+    if (regnum >= REG_COUNT)
+        return 0;
+    return sel == REG_LSB ? reg_snap[regnum] & 0xff : reg_snap[regnum] >> 8;
+}
+
+#ifdef BENCH_I2C_BAUD
+/* Bench image (see auxbench.c): stand in for a master polling all three
+ * encoders back to back, WRITE 1 0 then READ of 6 bytes.  Timer0
+ * interrupts once per bus byte, stages SSPSTAT/SSPBUF as the MSSP would
+ * for that byte (see i2c_slave.h) and runs i2c_interrupt ().  Read bytes
+ * hold the clock until their data is loaded, so the next byte is timed
+ * from there, as with clock stretching on the real bus.
+ */
+#define BENCH_BYTES     10      /* addr cmd regnum addr 5*data, NAK */
+#define BENCH_TMR0      (256 - _XTAL_FREQ / 4 / 2 / (BENCH_I2C_BAUD / 9))
+
+void
+bench_interrupt (void)
+{
+    static unsigned char n = 0;
+    unsigned char rd = (n >= 3);
+
+    if (!rd)
+        TMR0L = BENCH_TMR0;
+    i2c_bench_stat.S = 1;
+    i2c_bench_stat.R_W = rd;
+    i2c_bench_stat.D_A = (n != 0 && n != 3);
+    i2c_bench_stat.BF = !rd || n == 3;
+    i2c_bench_con1.CKP = (n == BENCH_BYTES - 1); /* released only on NAK */
+    switch (n) {
+        case 0:
+            i2c_bench_buf = I2C_ADDR << 1;
+            break;
+        case 1:
+            i2c_bench_buf = I2C_CMD_READ;
+            break;
+        case 2:
+            i2c_bench_buf = REG_RA_ENC;
+            break;
+        case 3:
+            i2c_bench_buf = (I2C_ADDR << 1) | 1;
+            break;
+    }
+    i2c_interrupt ();
+    if (rd)
+        TMR0L = BENCH_TMR0;
+    if (++n == BENCH_BYTES)
+        n = 0;
+}
+
+void
+bench_init (void)
+{
+    T0CON = 0x40;               /* T08BIT, instr clock, prescale 1:2 */
+    TMR0L = BENCH_TMR0;
+    TMR0IF = 0;
+    INTCONbits.TMR0IE = 1;
+    T0CONbits.TMR0ON = 1;
+}
+#endif
+
+void interrupt
+isr (void)
+{
+    if (INTCONbits.RABIE && INTCONbits.RABIF) {
+        enc_interrupt ();
+        INTCONbits.RABIF = 0;
+    }
+    if (SSPIE && SSPIF) {
+        i2c_interrupt ();
+        SSPIF = 0;
+    }
+    if (TMR2IE && TMR2IF) {
+        focus_tics++;
+        TMR2IF = 0;
+    }
+#ifdef BENCH_I2C_BAUD
+    if (INTCONbits.TMR0IE && TMR0IF) {
+        bench_interrupt ();
+        TMR0IF = 0;
+    }
+#endif
+}
+
+void
+main(void)
+{
+    OSCCONbits.IRCF = 7;        /* system clock HFOSC 16 MHz (x 4 with PLL) */
+    OSCCONbits.IDLEN = 1;       /* SLEEP enters idle mode (peripherals run) */
+
+    ANSEL = 0;                  /* disable all ADC inputs */
+    ANSELH = 0;
+    TRISA = 0;                  /* disable all digital inputs */
+    TRISB = 0;
+    TRISC = 0;
+    WPUA = 0;                   /* disable all pullups */
+    WPUB = 0;
+    IOCA = 0;                   /* disable all interrupt on change bits */
+    IOCB = 0;
+
+    i2c_init (I2C_ADDR);
+    enc_init ();
+    focus_init ();
+#ifdef BENCH_I2C_BAUD
+    bench_init ();
+#endif
+
+    PEIE = 1;                   /* enable peripheral interrupts */
+    GIE = 1;                    /* enable global interrupts */
+    for (;;) {
+        static unsigned char tics = 0;
+
+        if (tics != focus_tics) {
+            tics = focus_tics;
+            focus_poll ();
+        }
+        CLRWDT ();
+        SLEEP ();               /* idle until the next interrupt */
+    }
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
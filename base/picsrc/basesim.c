@@ -0,0 +1,561 @@
+/* basesim.c - run the base firmware against simulated hardware */
+
+/* main.c and i2c_slave.c are compiled for the host against sim/htc.h.
+ * The firmware's __delay_ms () calls sim_delay_ms (), which advances
+ * simulated time one AC tick (Timer2 period) at a time, calling isr ()
+ * for the tick and for each ADC conversion it starts, and runs scripted
+ * events at millisecond boundaries: I2C master transactions, handbox ADC
+ * voltages and the north switch.  Edges on PHASE1, PHASE2 and SQWAVE are
+ * traced.  For each measured interval the drive frequency, the time from
+ * the start of the interval until the cycle period settles (ramp), and
+ * the peak-to-peak SQWAVE edge jitter are reported.  Each tick's isr entry
+ * is delayed by a random 0 to max-jitter instruction cycles beyond the
+ * fixed ISR_ENTRY, as if an i2c_interrupt () were running when the period
+ * matched.  Edges and the Timer1 latency readings move with it, while the
+ * next period match does not, as on the real Timer2.
+ *
+ * Script lines (times in ms, # starts a comment):
+ *   <ms> i2c-write <reg> <val> [<val> ...]   burst write 16-bit registers
+ *   <ms> i2c-read <reg> [<nregs>]            burst read and print
+ *   <ms> i2c-expect <reg> <val> [<count>]    read reg count times, fail
+ *                                            unless each read is val
+ *   <ms> adc <chan> <volts>                  handbox ADC input (5V idle)
+ *   <ms> north <0|1>                         north switch pressed
+ *   <ms> measure <label> [<hz>|east|west|sidereal|lunar|solar|lunar-offset]
+ *   <ms> end
+ * Exits nonzero if a measured frequency is off by more than max ppm, if
+ * the drive never settles in an interval, or if an i2c-expect fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+
+#define SIM_DEFINE_SFRS
+#include "htc.h"
+#undef main
+#include "freq.h"
+#include "i2c_slave.h"
+
+#define I2C_ADDR        8       /* as in main.c */
+#define TICK_US         (1e6 / AC_TICK_HZ)
+#define TICKS_PER_MS    (AC_TICK_HZ / 1000)
+#define ISR_ENTRY       40      /* cycles from period match to TMR1 read */
+#define MAX_EVENTS      256
+#define MAX_ARGS        16
+
+void firmware_main (void);
+void isr (void);
+
+typedef struct {
+    unsigned long   ms;
+    int             argc;
+    char            *argv[MAX_ARGS];
+} event_t;
+
+typedef struct {
+    char            label[32];
+    double          hz;         /* expected, or 0 */
+    double          start;      /* us */
+    double          *edge;      /* SQWAVE rising edges (us) */
+    int             n;
+    int             size;
+} measure_t;
+
+static event_t events[MAX_EVENTS];
+static int nevents = 0;
+static int next_event = 0;
+static unsigned long end_ms = 0;
+static unsigned long sim_ms = 0;
+static double sim_us = 0;
+static unsigned long sim_ticks = 0;     /* since TMR2ON */
+static double adc_volts[16];
+static unsigned char eeprom[256];
+static measure_t measure;
+static int measuring = 0;
+static double max_ppm = 2;
+static unsigned long max_jitter = 150;  /* cycles, one i2c_interrupt () */
+static double isr_us = 0;               /* this tick's extra entry latency */
+
+/* cycle period tolerance: DDS dither plus isr entry jitter */
+#define SETTLE_TOL      (TICK_US + max_jitter * TICK_US / AC_TICK_COUNT)
+static int trace = 0;
+static int fail = 0;
+
+static const char *default_script[] = {
+    "0      measure startup sidereal",
+    "10000  adc 2 0.0",         /* WEST */
+    "10000  measure west west",
+    "20000  adc 2 5.0",
+    "20000  measure sidereal sidereal",
+    "30000  adc 8 0.0",         /* EAST */
+    "30000  measure east east",
+    "40000  adc 8 5.0",
+    "40000  i2c-write 1 %lu %lu",
+    "40000  measure lunar lunar",
+    "50000  i2c-read 1 2",
+    "50000  i2c-write 1 0 0",
+    "50000  measure sidereal sidereal",
+    "60000  i2c-write 35 2",    /* track-rate solar */
+    "60000  measure solar solar",
+    "70000  i2c-write 35 3 49152",  /* track-rate custom, 1.5x */
+    "70000  measure custom west",
+    "80000  i2c-write 35 1 32768 -1", /* lunar, fine offset */
+    "80000  measure lunar-offset lunar-offset",
+    "90000  i2c-read 35 3",
+    "90000  i2c-write 35 0 32768 0",
+    "90000  i2c-write 4 3",     /* PEC record a revolution, no guiding */
+    "90000  measure pec-record sidereal",
+    "700000 i2c-expect 4 0x0101",   /* playing a complete recording */
+    "700000 i2c-write 6 0",
+    "700000 i2c-expect 7 0 64",     /* every segment zero */
+    "700000 measure pec-play sidereal",
+    "710000 i2c-read 20 15",    /* isr latency statistics */
+    "710000 end",
+};
+
+static double
+mfreq (unsigned long incr)
+{
+    return (double)incr * AC_TICK_HZ / 4294967296.0;
+}
+
+static double
+rate_hz (const char *s)
+{
+    if (!strcmp (s, "east"))
+        return mfreq (INCR_EAST);
+    if (!strcmp (s, "west"))
+        return mfreq (INCR_WEST);
+    if (!strcmp (s, "sidereal"))
+        return mfreq (INCR_SIDEREAL);
+    if (!strcmp (s, "lunar"))
+        return mfreq (INCR_LUNAR);
+    if (!strcmp (s, "solar"))
+        return mfreq (INCR_SOLAR);
+    if (!strcmp (s, "lunar-offset"))    /* offset -1 */
+        return mfreq (INCR_LUNAR - (INCR_SIDEREAL >> 16));
+    return strtod (s, NULL);
+}
+
+unsigned char
+eeprom_read (unsigned char addr)
+{
+    return eeprom[addr];
+}
+
+void
+eeprom_write (unsigned char addr, unsigned char val)
+{
+    eeprom[addr] = val;
+}
+
+static void
+sim_isr (void)
+{
+    if (GIE && PEIE)
+        isr ();
+}
+
+/* Conversions complete instantly; the firmware chains the next channel
+ * from its ADC interrupt.
+ */
+static void
+adc_run (void)
+{
+    int n, r;
+
+    for (n = 0; n < 16 && ADCON0bits.ADON && ADCON0bits.GO_DONE; n++) {
+        r = (int)floor (adc_volts[ADCON0bits.CHS] / 5.0 * 1023 + 0.5);
+        if (r < 0)
+            r = 0;
+        if (r > 1023)
+            r = 1023;
+        ADRESH = r >> 8;
+        ADRESL = r & 0xff;
+        ADCON0bits.GO_DONE = 0;
+        ADIF = 1;
+        sim_isr ();
+    }
+}
+
+/* I2C master.  Each byte sets up SSPSTAT/SSPCON1 as the MSSP would for
+ * the slave (see AN734b and i2c_getstate ()) and raises SSPIF.
+ */
+static void
+ssp_event (void)
+{
+    SSPIF = 1;
+    if (SSPIE)
+        sim_isr ();
+}
+
+static void
+i2c_start (int rw)
+{
+    SSPSTATbits.S = 1;
+    SSPSTATbits.P = 0;
+    SSPSTATbits.D_A = 0;
+    SSPSTATbits.R_W = rw;
+    SSPSTATbits.BF = 1;
+    SSPCON1bits.CKP = rw ? 0 : 1;       /* slave holds SCL for reads */
+    SSPBUF = (I2C_ADDR << 1) | rw;
+    ssp_event ();
+}
+
+static void
+i2c_send (unsigned char c)
+{
+    SSPSTATbits.D_A = 1;
+    SSPSTATbits.R_W = 0;
+    SSPSTATbits.BF = 1;
+    SSPBUF = c;
+    ssp_event ();
+}
+
+static unsigned char
+i2c_recv (int last)
+{
+    unsigned char c = SSPBUF;           /* loaded by the previous event */
+
+    SSPSTATbits.D_A = 1;
+    SSPSTATbits.R_W = 1;
+    SSPSTATbits.BF = 0;
+    SSPCON1bits.CKP = last ? 1 : 0;     /* NACK after the last byte */
+    ssp_event ();
+    return c;
+}
+
+static void
+i2c_stop (void)
+{
+    SSPSTATbits.S = 0;
+    SSPSTATbits.P = 1;
+}
+
+static void
+i2c_write_regs (unsigned char reg, UINT16 *val, int n)
+{
+    int i;
+
+    i2c_start (0);
+    i2c_send (I2C_CMD_WRITE);
+    i2c_send (reg);
+    for (i = 0; i < n; i++) {
+        i2c_send (val[i] & 0xff);
+        i2c_send (val[i] >> 8);
+    }
+    i2c_stop ();
+}
+
+static void
+i2c_read_regs (unsigned char reg, UINT16 *val, int n)
+{
+    int i;
+
+    i2c_start (0);
+    i2c_send (I2C_CMD_READ);
+    i2c_send (reg);
+    i2c_stop ();
+    i2c_start (1);
+    for (i = 0; i < n; i++) {
+        val[i] = i2c_recv (0);
+        val[i] |= (UINT16)i2c_recv (i == n - 1) << 8;
+    }
+    i2c_stop ();
+}
+
+static void
+measure_edge (double t)
+{
+    if (measure.n == measure.size) {
+        measure.size = measure.size ? measure.size * 2 : 1024;
+        measure.edge = realloc (measure.edge, measure.size * sizeof (double));
+        if (!measure.edge) {
+            fprintf (stderr, "out of memory\n");
+            exit (1);
+        }
+    }
+    measure.edge[measure.n++] = t;
+}
+
+/* Find where the cycle period settles (within SETTLE_TOL of the final
+ * period for the rest of the interval), then fit a line to the edges from
+ * there on for frequency, and take jitter from the residuals.
+ */
+static void
+measure_end (void)
+{
+    measure_t *m = &measure;
+    double final = 0, hz, ppm = 0, t, t0, emin = 0, emax = 0;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int np = m->n - 1, k = 0, i;
+
+    if (!measuring)
+        return;
+    measuring = 0;
+    if (np < 8) {
+        printf ("\t%-12s\tno drive output\n", m->label);
+        fail = 1;
+        return;
+    }
+    for (i = np / 2; i < np; i++)
+        final += m->edge[i + 1] - m->edge[i];
+    final /= np - np / 2;
+    for (i = 0; i < np; i++)
+        if (fabs (m->edge[i + 1] - m->edge[i] - final) > SETTLE_TOL)
+            k = i + 1;
+    if (k > np - 4) {
+        printf ("\t%-12s\tdid not settle\n", m->label);
+        fail = 1;
+        return;
+    }
+    for (i = k; i < m->n; i++) {
+        double x = i - k, y = m->edge[i] - m->edge[k];
+
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    i = m->n - k;
+    t = (i * sxy - sx * sy) / (i * sxx - sx * sx);
+    t0 = (sy - t * sx) / i;
+    hz = 1e6 / t;
+    for (i = k; i < m->n; i++) {
+        double r = m->edge[i] - (m->edge[k] + t0 + (i - k) * t);
+
+        if (i == k || r < emin)
+            emin = r;
+        if (i == k || r > emax)
+            emax = r;
+    }
+    if (m->hz > 0) {
+        ppm = (hz / m->hz - 1) * 1e6;
+        if (fabs (ppm) > max_ppm)
+            fail = 1;
+    }
+    printf ("\t%-12s\t%9.5f\t%9.5f\t%+8.1f\t%8.1f\t%6.1f\n", m->label,
+            m->hz, hz, ppm, (m->edge[k] - m->start) / 1000, emax - emin);
+}
+
+static void
+measure_start (const char *label, double hz)
+{
+    measure_end ();
+    snprintf (measure.label, sizeof (measure.label), "%s", label);
+    measure.hz = hz;
+    measure.start = sim_us;
+    measure.n = 0;
+    measuring = 1;
+}
+
+static void
+finish (void)
+{
+    measure_end ();
+    printf ("drive timing %s %g ppm\n", fail ? "EXCEEDS" : "within",
+            max_ppm);
+    exit (fail ? 1 : 0);
+}
+
+static void
+run_event (event_t *e)
+{
+    const char *cmd = e->argv[0];
+    UINT16 val[MAX_ARGS];
+    int i, n;
+
+    if (!strcmp (cmd, "i2c-write") && e->argc >= 3) {
+        for (i = 2; i < e->argc; i++)
+            val[i - 2] = strtoul (e->argv[i], NULL, 0);
+        i2c_write_regs (strtoul (e->argv[1], NULL, 0), val, e->argc - 2);
+    } else if (!strcmp (cmd, "i2c-read") && e->argc >= 2) {
+        n = e->argc > 2 ? strtoul (e->argv[2], NULL, 0) : 1;
+        if (n > MAX_ARGS)
+            n = MAX_ARGS;
+        i2c_read_regs (strtoul (e->argv[1], NULL, 0), val, n);
+        printf ("/* %lums i2c-read %s:", sim_ms, e->argv[1]);
+        for (i = 0; i < n; i++)
+            printf (" 0x%04x", val[i]);
+        printf (" */\n");
+    } else if (!strcmp (cmd, "i2c-expect") && e->argc >= 3) {
+        n = e->argc > 3 ? strtoul (e->argv[3], NULL, 0) : 1;
+        for (i = 0; i < n; i++) {
+            i2c_read_regs (strtoul (e->argv[1], NULL, 0), val, 1);
+            if (val[0] != (UINT16)strtoul (e->argv[2], NULL, 0)) {
+                printf ("/* %lums i2c-expect %s: read %d is 0x%04x */\n",
+                        sim_ms, e->argv[1], i, val[0]);
+                fail = 1;
+                break;
+            }
+        }
+    } else if (!strcmp (cmd, "adc") && e->argc == 3) {
+        adc_volts[strtoul (e->argv[1], NULL, 0) & 0xf] = strtod (e->argv[2],
+                                                                 NULL);
+    } else if (!strcmp (cmd, "north") && e->argc == 2) {
+        PORTAbits.RA5 = !strtoul (e->argv[1], NULL, 0);    /* active low */
+    } else if (!strcmp (cmd, "measure") && e->argc >= 2) {
+        measure_start (e->argv[1], e->argc > 2 ? rate_hz (e->argv[2]) : 0);
+    } else if (!strcmp (cmd, "end")) {
+        finish ();
+    } else {
+        fprintf (stderr, "basesim: bad script command: %s\n", cmd);
+        exit (1);
+    }
+}
+
+static void
+trace_pins (void)
+{
+    static int last[3] = { 0, 0, 0 };
+    static const char *names[3] = { "PHASE1", "PHASE2", "SQWAVE" };
+    int now[3] = { PORTCbits.RC4, PORTCbits.RC3, PORTBbits.RB7 };
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (now[i] == last[i])
+            continue;
+        if (trace)
+            printf ("%.1f\t%s\t%d\n", sim_us + isr_us, names[i], now[i]);
+        if (i == 2 && now[i] && measuring)
+            measure_edge (sim_us + isr_us);
+        last[i] = now[i];
+    }
+}
+
+static void
+tick (void)
+{
+    unsigned long jitter = (unsigned long)(drand48 () * (max_jitter + 1));
+
+    sim_us += TICK_US;
+    isr_us = 0;
+    if (TMR2ON) {
+        TMR2IF = 1;
+        isr_us = (double)jitter * TICK_US / AC_TICK_COUNT;
+        if (T1CONbits.TMR1ON) {
+            unsigned long t1 = ++sim_ticks * AC_TICK_COUNT + ISR_ENTRY
+                               + jitter;
+
+            TMR1L = t1 & 0xff;
+            TMR1H = (t1 >> 8) & 0xff;
+        }
+    }
+    sim_isr ();
+    adc_run ();
+    trace_pins ();
+}
+
+void
+sim_delay_ms (unsigned int ms)
+{
+    int i;
+
+    while (ms-- > 0) {
+        while (next_event < nevents && events[next_event].ms <= sim_ms)
+            run_event (&events[next_event++]);
+        for (i = 0; i < TICKS_PER_MS; i++)
+            tick ();
+        sim_ms++;
+    }
+}
+
+static void
+add_event (const char *line)
+{
+    char *s = strdup (line), *p, *tok;
+    event_t *e = &events[nevents];
+
+    if ((p = strchr (s, '#')))
+        *p = '\0';
+    if (!(tok = strtok (s, " \t\n")))
+        return;
+    if (nevents == MAX_EVENTS) {
+        fprintf (stderr, "basesim: too many script events\n");
+        exit (1);
+    }
+    e->ms = strtoul (tok, NULL, 0);
+    e->argc = 0;
+    while ((tok = strtok (NULL, " \t\n")) && e->argc < MAX_ARGS)
+        e->argv[e->argc++] = tok;
+    if (e->argc == 0) {
+        fprintf (stderr, "basesim: bad script line: %s", line);
+        exit (1);
+    }
+    if (nevents > 0 && e->ms < events[nevents - 1].ms) {
+        fprintf (stderr, "basesim: script times must not decrease\n");
+        exit (1);
+    }
+    if (e->ms >= end_ms)
+        end_ms = e->ms + 1;
+    nevents++;
+}
+
+void
+usage (void)
+{
+    fprintf (stderr,
+"Usage: basesim [-t] [-m max-ppm] [-j max-jitter] [script]\n"
+    );
+    exit (1);
+}
+
+int
+main (int argc, char *argv[])
+{
+    char line[256];
+    int c, i;
+
+    while ((c = getopt (argc, argv, "tm:j:")) != -1) {
+        switch (c) {
+            case 't':
+                trace = 1;
+                break;
+            case 'm':
+                max_ppm = strtod (optarg, NULL);
+                break;
+            case 'j':
+                max_jitter = strtoul (optarg, NULL, 0);
+                break;
+            default:
+                usage ();
+        }
+    }
+    if (optind < argc - 1)
+        usage ();
+    if (optind == argc - 1) {
+        FILE *f = fopen (argv[optind], "r");
+
+        if (!f) {
+            perror (argv[optind]);
+            exit (1);
+        }
+        while (fgets (line, sizeof (line), f))
+            add_event (line);
+        fclose (f);
+    } else {
+        for (i = 0; i < sizeof (default_script) / sizeof (char *); i++) {
+            snprintf (line, sizeof (line), default_script[i],
+                      INCR_LUNAR & 0xffff, INCR_LUNAR >> 16);
+            add_event (line);
+        }
+    }
+
+    srand48 (1);
+    for (i = 0; i < 16; i++)
+        adc_volts[i] = 5.0;             /* no buttons pressed */
+    memset (eeprom, 0xff, sizeof (eeprom));
+    PORTAbits.RA5 = 1;                  /* north switch pulled up */
+
+    printf ("/*\tinterval\ttarget(Hz)\tactual(Hz)\terror(ppm)"
+            "\tramp(ms)\tjitter p-p(us) */\n");
+    firmware_main ();                   /* exits via finish () */
+    exit (1);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
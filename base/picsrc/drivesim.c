@@ -0,0 +1,173 @@
+/* drivesim.c - compare AC motor current for square and sine PWM drive */
+
+/* Reproduces the PHASE1/PHASE2 output of ac_interrupt () in each
+ * ac_mode_t at 1us resolution (one PWM duty step) and applies it to the
+ * motor, modelled as a series RL load behind an ideal transformer.
+ * While neither phase conducts the winding is assumed clamped, so the
+ * motor sees 0V.  After the start-up transient, harmonics of voltage and
+ * current are computed by DFT over whole drive cycles.  Battery current
+ * is the real power delivered divided by the supply voltage.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "freq.h"
+
+#define _XTAL_FREQ      64000000
+#define INSTR_FREQ      (_XTAL_FREQ / 4)
+#define STEPS_PER_TICK  (AC_TICK_PR2 + 1)   /* duty resolution */
+
+#define SETTLE_CYCLES   20
+#define MEASURE_CYCLES  10
+#define NHARMONICS      15
+
+#define SUPPLY_V        12.0
+
+typedef enum { AC_MODE_SQUARE=0, AC_MODE_SINE=1 } ac_mode_t;
+
+static const char *mode_names[] = { "square", "sine" };
+
+typedef struct {
+    double          v[NHARMONICS + 1];  /* rms per harmonic */
+    double          i[NHARMONICS + 1];
+    double          vrms, irms, power;
+} result_t;
+
+/* Motor voltage sign (+1, 0, -1) for one tick, as output by the firmware:
+ * square - PHASE1 for quarter 0, PHASE2 for quarter 2, whole tick
+ * sine   - PHASE1 in half 0, PHASE2 in half 1, for duty steps of the tick
+ */
+static void
+drive_tick (ac_mode_t mode, unsigned long phase, int *sign, int *duty)
+{
+    unsigned char q = (unsigned char)(phase >> 30);
+
+    if (mode == AC_MODE_SQUARE) {
+        *sign = q == 0 ? 1 : q == 2 ? -1 : 0;
+        *duty = STEPS_PER_TICK;
+    } else {
+        *sign = q < 2 ? 1 : -1;
+        *duty = ac_sine[((unsigned char)(phase >> 24) >> 1) & 0x3f];
+    }
+}
+
+static result_t
+simulate (ac_mode_t mode, unsigned long incr, double vpk, double r, double l)
+{
+    double hz = (double)incr * AC_TICK_HZ / 4294967296.0;
+    double dt = 1.0 / (AC_TICK_HZ * STEPS_PER_TICK);
+    double re_v[NHARMONICS + 1] = { 0 }, im_v[NHARMONICS + 1] = { 0 };
+    double re_i[NHARMONICS + 1] = { 0 }, im_i[NHARMONICS + 1] = { 0 };
+    double cur = 0, t = 0, t0 = -1, v2 = 0, i2 = 0, p = 0;
+    unsigned long phase = 0;
+    unsigned char q, lastq = 0;
+    int cycles = 0, sign, duty, k, n;
+    result_t res;
+
+    while (cycles < SETTLE_CYCLES + MEASURE_CYCLES) {
+        drive_tick (mode, phase, &sign, &duty);
+        for (k = 0; k < STEPS_PER_TICK; k++) {
+            double v = k < duty ? sign * vpk : 0;
+
+            cur += (v - r * cur) / l * dt;
+            if (t0 >= 0) {
+                double w = 2 * M_PI * hz * (t - t0);
+
+                for (n = 1; n <= NHARMONICS; n++) {
+                    re_v[n] += v * cos (n * w) * dt;
+                    im_v[n] += v * sin (n * w) * dt;
+                    re_i[n] += cur * cos (n * w) * dt;
+                    im_i[n] += cur * sin (n * w) * dt;
+                }
+                v2 += v * v * dt;
+                i2 += cur * cur * dt;
+                p += v * cur * dt;
+            }
+            t += dt;
+        }
+        phase = (phase + incr) & 0xffffffffUL;
+        q = (unsigned char)(phase >> 30);
+        if (q == 0 && lastq != 0) {
+            if (++cycles == SETTLE_CYCLES)
+                t0 = t;
+        }
+        lastq = q;
+    }
+    t -= t0;
+    for (n = 1; n <= NHARMONICS; n++) {
+        res.v[n] = sqrt (re_v[n] * re_v[n] + im_v[n] * im_v[n]) * 2 / t
+                   / sqrt (2);
+        res.i[n] = sqrt (re_i[n] * re_i[n] + im_i[n] * im_i[n]) * 2 / t
+                   / sqrt (2);
+    }
+    res.vrms = sqrt (v2 / t);
+    res.irms = sqrt (i2 / t);
+    res.power = p / t;
+    return res;
+}
+
+static double
+thd (const double *h, double rms)
+{
+    return sqrt (rms * rms - h[1] * h[1]) / h[1] * 100;
+}
+
+void
+usage (void)
+{
+    fprintf (stderr,
+"Usage: drivesim [-v peak-volts] [-r ohms] [-l henries]\n"
+    );
+    exit (1);
+}
+
+int
+main (int argc, char *argv[])
+{
+    double vpk = 170;           /* transformer secondary peak */
+    double r = 2400;            /* motor winding */
+    double l = 11;
+    result_t res[2];
+    int c, m, n;
+
+    while ((c = getopt (argc, argv, "v:r:l:")) != -1) {
+        switch (c) {
+            case 'v':
+                vpk = strtod (optarg, NULL);
+                break;
+            case 'r':
+                r = strtod (optarg, NULL);
+                break;
+            case 'l':
+                l = strtod (optarg, NULL);
+                break;
+            default:
+                usage ();
+        }
+    }
+    for (m = AC_MODE_SQUARE; m <= AC_MODE_SINE; m++)
+        res[m] = simulate (m, INCR_SIDEREAL, vpk, r, l);
+
+    printf ("/* sidereal rate, %.0fV peak, R=%.0f ohm, L=%.2f H */\n",
+            vpk, r, l);
+    printf ("/*\tmode\tV1(rms)\tVTHD%%\tI1(mA)\tIrms(mA)\tITHD%%"
+            "\tP(W)\tIbatt(mA) */\n");
+    for (m = AC_MODE_SQUARE; m <= AC_MODE_SINE; m++)
+        printf ("\t%s\t%.1f\t%.1f\t%.2f\t%.2f\t\t%.1f\t%.3f\t%.1f\n",
+                mode_names[m], res[m].v[1], thd (res[m].v, res[m].vrms),
+                res[m].i[1] * 1000, res[m].irms * 1000,
+                thd (res[m].i, res[m].irms), res[m].power,
+                res[m].power / SUPPLY_V * 1000);
+    printf ("/*\tn\tI(mA) square\tI(mA) sine */\n");
+    for (n = 1; n <= NHARMONICS; n += 2)
+        printf ("\t%d\t%.3f\t\t%.3f\n", n, res[0].i[n] * 1000,
+                res[1].i[n] * 1000);
+    exit (0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
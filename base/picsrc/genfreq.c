@@ -1,4 +1,4 @@
-/* genfreq.c - calculate timer count values */
+/* genfreq.c - calculate DDS phase increments for the AC drive */
 
 #include <stdio.h>
 #include <math.h>
@@ -12,107 +12,111 @@
 #define LUNAR_HZ       48.912
 #define SIDEREAL_HZ    50.0
 #endif
+#define SOLAR_HZ       (SIDEREAL_HZ * 0.99726957)  /* sidereal/solar day */
 
 #define _XTAL_FREQ 64000000
-#define PRESCALER_RATIO 8
+#ifndef TICK_HZ
+#define TICK_HZ    10000        /* ac_interrupt () rate, nominal */
+#endif
+
+/* The drive phase is a 32-bit accumulator advanced by incr each tick,
+ * so one drive cycle is 2^32 / incr ticks.
+ */
+#define PHASE_MOD  4294967296.0
+
+/* Sine PWM duty (CCPR1L) per 1/SINE_STEPS of a half cycle.  The amplitude
+ * gives the same fundamental as the square drive, where each phase
+ * conducts for one quarter cycle: 2*sqrt(2)/pi.
+ */
+#define SINE_STEPS 64
+#define SINE_AMPL  (2.0 * sqrt (2.0) / M_PI)
+
+/* Actual tick rate of the chosen Timer2 configuration.  Increments are
+ * computed against it, so a tick that is not exactly TICK_HZ costs no
+ * rate accuracy.
+ */
+double tick_hz;
+
+unsigned long
+incr (double hz)
+{
+	return (unsigned long)floor (hz * PHASE_MOD / tick_hz + 0.5);
+}
 
 double
-mfreq (int count, double countfreq)
+mfreq (unsigned long incr)
 {
-    double intrfreq = countfreq/(255*255 - count + 1);
+	return (double)incr * tick_hz / PHASE_MOD;
+}
+
+/* Error in ppm, and the drive cycle lengths in ticks.  The accumulator
+ * dithers between the two lengths so that their average is exact.
+ */
+void
+define (const char *name, double hz, const char *comment)
+{
+	unsigned long i = incr (hz);
+	double ticks = PHASE_MOD / i;
+	unsigned long lo = (unsigned long)floor (ticks);
 
-    return intrfreq/4;
+	printf ("#define %-16s%luUL\t/* %f\t%+.4f\t%lu/%lu\t%2.0f%% */%s\n",
+		name, i, hz, (mfreq (i) - hz) / hz * 1e6, lo, lo + 1,
+		(ticks - lo) * 100, comment);
 }
 
 int
 main (int argc, char *argv[])
 {
-	int i, j;
-	double targ[] = {
-		0.50*SIDEREAL_HZ,
-		0.525*SIDEREAL_HZ,
-		0.55*SIDEREAL_HZ,
-		0.575*SIDEREAL_HZ,
-		0.60*SIDEREAL_HZ,
-		0.625*SIDEREAL_HZ,
-		0.65*SIDEREAL_HZ,
-		0.675*SIDEREAL_HZ,
-		0.70*SIDEREAL_HZ,
-		0.725*SIDEREAL_HZ,
-		0.75*SIDEREAL_HZ,
-		0.775*SIDEREAL_HZ,
-		0.80*SIDEREAL_HZ,
-		0.825*SIDEREAL_HZ,
-		0.85*SIDEREAL_HZ,
-		0.875*SIDEREAL_HZ,
-		0.90*SIDEREAL_HZ,
-		0.925*SIDEREAL_HZ,
-		0.95*SIDEREAL_HZ,
-		0.975*SIDEREAL_HZ,
-		LUNAR_HZ,
-                SIDEREAL_HZ,
-		1.025*SIDEREAL_HZ,
-		1.05*SIDEREAL_HZ,
-		1.075*SIDEREAL_HZ,
-		1.10*SIDEREAL_HZ,
-		1.125*SIDEREAL_HZ,
-		1.15*SIDEREAL_HZ,
-		1.175*SIDEREAL_HZ,
-		1.20*SIDEREAL_HZ,
-		1.225*SIDEREAL_HZ,
-		1.25*SIDEREAL_HZ,
-		1.275*SIDEREAL_HZ,
-		1.30*SIDEREAL_HZ,
-		1.325*SIDEREAL_HZ,
-		1.35*SIDEREAL_HZ,
-		1.375*SIDEREAL_HZ,
-		1.40*SIDEREAL_HZ,
-		1.425*SIDEREAL_HZ,
-		1.45*SIDEREAL_HZ,
-		1.475*SIDEREAL_HZ,
-		1.50*SIDEREAL_HZ,
-		//1.55*SIDEREAL_HZ,
-		//1.60*SIDEREAL_HZ,
-		//1.65*SIDEREAL_HZ,
-		//1.70*SIDEREAL_HZ,
-		//1.75*SIDEREAL_HZ,
-		//1.80*SIDEREAL_HZ,
-		//1.85*SIDEREAL_HZ,
-		//1.90*SIDEREAL_HZ,
-		//1.95*SIDEREAL_HZ,
-		//2.0*SIDEREAL_HZ,
-	 };
-	int val[sizeof(targ)/sizeof(targ[0])];
-	double prescaler = PRESCALER_RATIO;
-	double countfreq = (double)_XTAL_FREQ/(4*prescaler);
-
-	for (j = 0; j < sizeof(targ)/sizeof(targ[0]); j++)
-		val[j] = 0;
-	for (i = 0; i < 256*256; i++) {
-		for (j = 0; j < sizeof(targ)/sizeof(targ[0]); j++) {
-			double d = fabs (mfreq(val[j], countfreq) - targ[j]);
-
-			if (d > fabs (mfreq(i, countfreq) - targ[j]))
-				val[j] = i;
+	double instr_freq = (double)_XTAL_FREQ / 4;
+	double best_err = 1;
+	int t2ckps, pr2, best_ps = -1, best_pr2 = -1, i;
+
+	/* Timer2: prescaler 1:1, 1:4, 1:16 and 8-bit period register.
+	 * Search jointly for the period closest to TICK_HZ, preferring the
+	 * longest PR2 (finest PWM resolution) among equals.
+	 */
+	for (t2ckps = 0; t2ckps < 3; t2ckps++) {
+		for (pr2 = 0; pr2 < 256; pr2++) {
+			double hz = instr_freq / ((1 << (2 * t2ckps)) * (pr2 + 1));
+			double err = fabs (hz - TICK_HZ) / TICK_HZ;
+
+			if (err < best_err - 1e-12 || (err < best_err + 1e-12
+						       && pr2 > best_pr2)) {
+				best_err = err;
+				best_ps = t2ckps;
+				best_pr2 = pr2;
+			}
 		}
 	}
+	assert (best_ps >= 0);
+	tick_hz = instr_freq / ((1 << (2 * best_ps)) * (best_pr2 + 1));
 
 	printf ("/* generated with genfreq - DO NOT EDIT */\n");
-	printf ("UINT16 freq[] = {\n");
-	printf("/*\tcount\t   target(Hz)\terror */\n");
-	for (j = 0; j < sizeof(targ)/sizeof(targ[0]); j++)
-		printf ("/*%d*/\t%d,\t/* %f\t%+f */%s\n", j, val[j],
-			targ[j], mfreq(val[j], countfreq) - targ[j],
-			targ[j] == LUNAR_HZ ? " /* lunar rate */" :
-			targ[j] == SIDEREAL_HZ ? " /* sidereal rate */" : "");
-	printf ("};\n");
-	printf ("#define FREQ_EAST	0\n");
-	for (j = 0; j < sizeof(targ)/sizeof(targ[0]); j++) {
-       		if (targ[j] == LUNAR_HZ)
-			printf ("#define FREQ_LUNAR	%d\n", j);
-		else if (targ[j] == SIDEREAL_HZ)
-			printf ("#define FREQ_SIDEREAL	%d\n", j);
+	printf ("#define AC_TICK_HZ\t%d\t/* nominal, actual %f (%+.4f ppm) */\n",
+		TICK_HZ, tick_hz, (tick_hz - TICK_HZ) / TICK_HZ * 1e6);
+	printf ("#define AC_TICK_COUNT\t%d\t/* instr cycles per tick */\n",
+		(1 << (2 * best_ps)) * (best_pr2 + 1));
+	printf ("#define AC_TICK_T2CKPS\t%d\t/* 1:%d */\n", best_ps,
+		1 << (2 * best_ps));
+	printf ("#define AC_TICK_PR2\t%d\n", best_pr2);
+	printf ("/*\t\t\tincr\t   target(Hz)\terror(ppm)\tticks/cycle"
+		"\tlong */\n");
+	define ("INCR_EAST", 0.50*SIDEREAL_HZ, "");
+	define ("INCR_LUNAR", LUNAR_HZ, " /* lunar rate */");
+	define ("INCR_SOLAR", SOLAR_HZ, " /* solar rate */");
+	define ("INCR_SIDEREAL", SIDEREAL_HZ, " /* sidereal rate */");
+	define ("INCR_WEST", 1.50*SIDEREAL_HZ, "");
+	printf ("#define INCR_ACCEL_Q8\t%luUL\t/* incr/tick per Hz/s, x256 */\n",
+		(unsigned long)floor (256.0 * PHASE_MOD / tick_hz / tick_hz + 0.5));
+
+	printf ("#define AC_SINE_STEPS\t%d\n", SINE_STEPS);
+	printf ("static const unsigned char ac_sine[AC_SINE_STEPS] = {");
+	for (i = 0; i < SINE_STEPS; i++) {
+		double d = SINE_AMPL * sin (M_PI * (i + 0.5) / SINE_STEPS);
+
+		printf ("%s%d,", i % 16 ? " " : "\n\t",
+			(int)floor (d * (best_pr2 + 1) + 0.5));
 	}
-	printf ("#define FREQ_WEST	%d\n", j - 1);
+	printf ("\n};\n");
 	exit (0);
 }
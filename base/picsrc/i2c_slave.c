@@ -26,8 +26,15 @@
  * To write a register, master writes 2 <regnum> <lsb> [<msb>]
  * To read a register, master writes 1 <regnum>, then reads <lsb> [<msb>].
  * After a read or a write, another read re-samples the same <regnum>.
+ * Bursts: bytes past the first register's <msb> continue with <lsb> <msb>
+ * of <regnum>+1, <regnum>+2, etc., for both reads and writes.
  *
- * N.B. expects reg_set () and reg_get () to be defined externally
+ * reg_snapshot () is called as each read starts, with the read's first
+ * register, so the slave can latch all readable registers at once for
+ * reg_get () and tell a read of a register from one passing over it.
+ *
+ * N.B. expects reg_set (), reg_get () and reg_snapshot () to be defined
+ * externally
  */
 
 /* NOTE: compiled with hi-tech C pro V9.80 */
@@ -35,21 +42,43 @@
 #include <htc.h>
 #include "i2c_slave.h"
 
+/* MSSP registers used by the state machine (staged in RAM on the bench).
+ */
+#ifdef BENCH_I2C_BAUD
+volatile unsigned char    i2c_bench_buf = 0;
+volatile i2c_bench_stat_t i2c_bench_stat = { 0, 0, 0, 0 };
+volatile i2c_bench_con1_t i2c_bench_con1 = { 0, 0 };
+
+#define I2C_BUF         i2c_bench_buf
+#define I2C_STAT        i2c_bench_stat
+#define I2C_CON1        i2c_bench_con1
+#else
+#define I2C_BUF         SSPBUF
+#define I2C_STAT        SSPSTATbits
+#define I2C_CON1        SSPCON1bits
+#endif
+
 static unsigned char
 i2c_read (void)
 {
-    return SSPBUF;
+    return I2C_BUF;
 }
 
 static void
 i2c_write (unsigned char c)
 {
-    SSPCON1bits.CKP = 0;
-    SSPBUF = c;
-    SSPCON1bits.CKP = 1;
+    I2C_CON1.CKP = 0;
+    I2C_BUF = c;
+    I2C_CON1.CKP = 1;
     (void)i2c_read();
 }
 
+/* Register and byte addressed by the nth data byte of a transfer.
+ */
+#define BURST_REG(regnum,n)     ((regnum) + ((n) >> 1))
+#define BURST_SEL(n)            (((n) & 1) ? REG_MSB : REG_LSB)
+#define COUNT_MAX               0xff
+
 /* See AN734b for 18F series I2C slave state descriptions
  */
 static unsigned char
@@ -59,39 +88,39 @@ i2c_getstate (void)
 
     // State 1: I2C write operation, last byte was an address byte
     // SSPSTAT bits: S = 1, D_A = 0, R_W = 0, BF = 1
-    if (SSPSTATbits.S == 1 && SSPSTATbits.D_A == 0
-                           && SSPSTATbits.R_W == 0
-                           && SSPSTATbits.BF == 1) {
+    if (I2C_STAT.S == 1 && I2C_STAT.D_A == 0
+                        && I2C_STAT.R_W == 0
+                        && I2C_STAT.BF == 1) {
         state = 1;
     }
     // State 2: I2C write operation, last byte was a data byte
     // SSPSTAT bits: S = 1, D_A = 1, R_W = 0, BF = 1
-    if (SSPSTATbits.S == 1 && SSPSTATbits.D_A == 1
-                                  && SSPSTATbits.R_W == 0
-                                  && SSPSTATbits.BF == 1) {
+    if (I2C_STAT.S == 1 && I2C_STAT.D_A == 1
+                        && I2C_STAT.R_W == 0
+                        && I2C_STAT.BF == 1) {
         state = 2;
     }
     // State 3: I2C read operation, last byte was an address byte
     // SSPSTAT bits: S = 1, D_A = 0, R_W = 1
-    if (SSPSTATbits.S == 1 && SSPSTATbits.D_A == 0
-                           && SSPSTATbits.R_W == 1) {
+    if (I2C_STAT.S == 1 && I2C_STAT.D_A == 0
+                        && I2C_STAT.R_W == 1) {
 
         state = 3;
     }
     // State 4: I2C read operation, last byte was a data byte
     // SSPSTAT bits: S = 1, D_A = 1, R_W = 1, BF = 0
-    if (SSPSTATbits.S == 1 && SSPSTATbits.D_A == 1
-                           && SSPSTATbits.R_W == 1
-                           && SSPSTATbits.BF == 0) {
+    if (I2C_STAT.S == 1 && I2C_STAT.D_A == 1
+                        && I2C_STAT.R_W == 1
+                        && I2C_STAT.BF == 0) {
 
         state = 4;
     
     }
     // State 5: Slave I2C logic reset by NACK from master
     // SSPSTAT bits: S = 1, D_A = 1, BF = 0, CKP = 1
-    if (SSPSTATbits.S == 1 && SSPSTATbits.D_A == 1
-                           && SSPSTATbits.BF == 0
-                           && SSPCON1bits.CKP == 1) {
+    if (I2C_STAT.S == 1 && I2C_STAT.D_A == 1
+                        && I2C_STAT.BF == 0
+                        && I2C_CON1.CKP == 1) {
         state = 5;
     }
     return state;
@@ -114,26 +143,25 @@ i2c_interrupt (void)
                cmd = i2c_read ();
             } else if (count == 1) {
                regnum = i2c_read ();
-            } else if (count == 2 && cmd == I2C_CMD_WRITE) {
-               reg_set (regnum, i2c_read (), REG_LSB);
-            } else if (count == 3 && cmd == I2C_CMD_WRITE) {
-               reg_set (regnum, i2c_read (), REG_MSB);
+            } else if (cmd == I2C_CMD_WRITE) {
+               reg_set (BURST_REG (regnum, count - 2), i2c_read (),
+                        BURST_SEL (count - 2));
             } else {
                (void)i2c_read();
             }
-            count++;
+            if (count < COUNT_MAX)
+                count++;
             break;
         case 3: /* read 1st byte */
             count = 0;
+            reg_snapshot (regnum);
             i2c_write (reg_get (regnum, REG_LSB));
             count++;
             break;
         case 4: /* read 2..Nth byte */
-            if (count == 1)
-                i2c_write (reg_get (regnum, REG_MSB));
-            else
-                i2c_write (0);
-            count++;
+            i2c_write (reg_get (BURST_REG (regnum, count), BURST_SEL (count)));
+            if (count < COUNT_MAX)
+                count++;
             break;
         case 5:  /* NAK */
             count = 0;
@@ -143,8 +171,8 @@ i2c_interrupt (void)
             break;
     }
 
-    if (SSPCON1bits.SSPOV) {
-        SSPCON1bits.SSPOV = 0;
+    if (I2C_CON1.SSPOV) {
+        I2C_CON1.SSPOV = 0;
         (void)i2c_read();
     }
 }
@@ -6,3 +6,24 @@ void i2c_init (unsigned char addr);
 
 void          reg_set (unsigned char regnum, unsigned char val, regbyte_t sel);
 unsigned char reg_get (unsigned char regnum, regbyte_t sel);
+void          reg_snapshot (unsigned char first);
+
+#ifdef BENCH_I2C_BAUD
+/* Bench builds stage the MSSP state i2c_interrupt () reads in RAM, so a
+ * timer interrupt can drive it with a scripted transfer.
+ */
+typedef struct {
+    unsigned BF:1;
+    unsigned S:1;
+    unsigned R_W:1;
+    unsigned D_A:1;
+} i2c_bench_stat_t;
+typedef struct {
+    unsigned CKP:1;
+    unsigned SSPOV:1;
+} i2c_bench_con1_t;
+
+extern volatile unsigned char    i2c_bench_buf;
+extern volatile i2c_bench_stat_t i2c_bench_stat;
+extern volatile i2c_bench_con1_t i2c_bench_con1;
+#endif
@@ -32,7 +32,7 @@
 
 #if defined(_18F14K22)
 __CONFIG (1, FOSC_IRC & PLLEN_ON);  /* system clock is HFOSC*4 */
-__CONFIG (2, BOREN_OFF & WDTEN_OFF);
+__CONFIG (2, BOREN_SBORDIS & BORV_27 & WDTEN_ON & WDTPS_256); /* ~1s WDT */
 __CONFIG (3, HFOFST_OFF & MCLRE_OFF);
 __CONFIG (4, LVP_OFF);
 #else
@@ -69,142 +69,1165 @@ static volatile char ibuttons = 0; /* i2c version of above */
 
 static volatile char output_inhibit = 1;
 
-static volatile char ac_freq_now = FREQ_EAST;
-static volatile char ac_freq_targ = FREQ_SIDEREAL;
-static volatile UINT16 ac_count_special = 0; /* disabled */
+/* The AC drive is a direct digital synthesizer: every Timer2 tick
+ * (AC_TICK_HZ) a 32-bit phase accumulator advances by the phase increment,
+ * and its top two bits select the quarter cycle driven on PHASE1/PHASE2.
+ * Drive frequency is incr * AC_TICK_HZ / 2^32 (see genfreq.c).
+ * The tick is the Timer2 PR2 period, so it is set by hardware and isr
+ * entry latency cannot stretch it (basesim checks this).
+ */
+static volatile unsigned long ac_incr_now = INCR_EAST;
+static volatile unsigned long ac_incr_targ = INCR_SIDEREAL;
+static volatile unsigned long ac_incr_special = 0; /* disabled */
+
+#define AC_STARTUP_TICS     (4U * AC_TICK_HZ)
+#define AC_WARM_TICS        (AC_TICK_HZ / 20)   /* 3 cycles at 60 Hz */
+static UINT16 ac_startup_tics = AC_STARTUP_TICS;
+
+/* Rate changes are ramped every tick at a fixed acceleration in Hz/s,
+ * so ramp time depends only on the size of the change.  The S-curve
+ * profile also limits jerk, reaching full acceleration in AC_JERK_TICS.
+ * Either way the ramp lands on the target without overshoot.
+ */
+#ifndef AC_ACCEL_HZ
+#define AC_ACCEL_HZ         90      /* Hz/s */
+#endif
+#define AC_JERK_TICS        (AC_TICK_HZ / 10)
+typedef enum { AC_PROFILE_LINEAR=0, AC_PROFILE_SCURVE=1 } ac_profile_t;
+static volatile UINT16 ac_accel_hz = AC_ACCEL_HZ;
+static volatile unsigned char ac_profile = AC_PROFILE_SCURVE;
+static volatile unsigned long ac_accel = 0;     /* max incr change/tick */
+static volatile unsigned long ac_jerk = 0;      /* accel change/tick */
+
+/* In AC_MODE_SINE the ECCP PWM (period = one tick) is steered to PHASE1
+ * (P1B) for the first half cycle and PHASE2 (P1C) for the second, with
+ * duty from the ac_sine[] table, approximating a sine at the transformer.
+ * The PWM pin (P1A) is not steered, and dc_sw_tic () drives it instead.
+ */
+typedef enum { AC_MODE_SQUARE=0, AC_MODE_SINE=1 } ac_mode_t;
+static volatile unsigned char ac_mode = AC_MODE_SQUARE;
+static volatile unsigned char ac_mode_targ = AC_MODE_SQUARE;
+
+#define CCP1CON_PWM         0x0c    /* single output, active high PWM */
+#define PSTRCON_NONE        0x10    /* STRSYNC */
+#define PSTRCON_PHASE1      0x12    /* STRSYNC | STRB */
+#define PSTRCON_PHASE2      0x14    /* STRSYNC | STRC */
+#define PSTRCON_DC          0x11    /* STRSYNC | STRA */
+
+/* In AC_MODE_SQUARE the same PWM is steered to the PWM pin (P1A), the
+ * H-bridge enable shared by the dec and focus motors, with duty dc_ccpr.
+ * In AC_MODE_SINE the pin is a software PWM of DC_SW_STEPS ticks (100 Hz,
+ * 1% steps) with duty dc_pct.
+ */
+#define DC_SW_STEPS     100
+static volatile unsigned char dc_ccpr = AC_TICK_PR2 + 1;  /* full on */
+static volatile unsigned char dc_pct = 100;
+
+/* DC motor speed is the duty cycle of the shared H-bridge enable, in
+ * percent, per motor for each of two speeds.  The handbox LAMP button
+ * toggles between them.  Starting or reversing a motor restarts a soft
+ * start ramp of DC_SOFT_STEP percent per main loop pass (~1ms).  While
+ * both motors run the higher duty applies; while neither runs the enable
+ * is held on so the motors brake.  The sine AC drive needs the PWM
+ * module, so in that mode the duty is applied in software at 100 Hz.
+ */
+typedef enum { DC_DEC=0, DC_FOCUS=1 } dc_motor_t;
+typedef enum { DC_FAST=0, DC_SLOW=1 } dc_speed_t;
+#define DC_SOFT_STEP    1
+static volatile unsigned char dc_duty[2][2] = { { 100, 25 }, { 100, 25 } };
+static volatile unsigned char dc_speed = DC_FAST;
+static unsigned char dc_soft = 0;
+static char dc_running[2] = { 0, 0 };
+
+void
+ac_set_mode (unsigned char mode)
+{
+    switch (mode) {
+        case AC_MODE_SQUARE:
+            CCPR1L = dc_ccpr;
+            PSTRCON = PSTRCON_DC;
+            CCP1CON = CCP1CON_PWM;
+            break;
+        case AC_MODE_SINE:
+            PHASE1 = 0;
+            PHASE2 = 0;
+            CCPR1L = 0;
+            PSTRCON = PSTRCON_NONE;
+            CCP1CON = CCP1CON_PWM;
+            break;
+    }
+    ac_mode = mode;
+}
+
+/* Software PWM on the DC enable, called every tick in AC_MODE_SINE.
+ */
+void
+dc_sw_tic (void)
+{
+    static unsigned char n = 0;
+
+    if (++n >= DC_SW_STEPS)
+        n = 0;
+    PWM = (n < dc_pct);
+}
+
+void
+ac_set_incr (unsigned long incr)
+{
+    TMR2IE = 0;
+    ac_incr_targ = incr;
+    TMR2IE = 1;
+}
+
+/* Called from the main loop: convert ac_accel_hz (which i2c may change)
+ * to phase increment units per tick.
+ */
+void
+ac_poll_accel (void)
+{
+    static UINT16 hz = 0;
+    unsigned long accel, jerk;
+
+    if (hz == ac_accel_hz && ac_accel != 0)
+        return;
+    hz = ac_accel_hz;
+    accel = ((unsigned long)hz * INCR_ACCEL_Q8) >> 8;
+    if (accel == 0)
+        accel = 1;
+    jerk = accel / AC_JERK_TICS;
+    if (jerk == 0)
+        jerk = 1;
+    TMR2IE = 0;
+    ac_accel = accel;
+    ac_jerk = jerk;
+    TMR2IE = 1;
+}
+
+unsigned long
+ac_get_incr (void)
+{
+    unsigned long incr;
+
+    TMR2IE = 0;
+    incr = ac_incr_now;
+    TMR2IE = 1;
+
+    return incr;
+}
+
+/* Tracking rate, selected over I2C: sidereal, lunar, solar, or a custom
+ * multiple of sidereal in track-custom, plus a signed fine offset in
+ * TRACK_OFFSET_UNITs.  track_poll () computes track_incr in the main loop
+ * when they change, clamped to the handbox east/west rates.  action ()
+ * tracks at track_incr plus any PEC offset, and PEC records against it.
+ */
+typedef enum {
+    TRACK_SIDEREAL=0, TRACK_LUNAR=1, TRACK_SOLAR=2, TRACK_CUSTOM=3,
+} track_t;
+#define TRACK_CUSTOM_ONE    0x8000                  /* 1x sidereal */
+#define TRACK_OFFSET_UNIT   (INCR_SIDEREAL >> 16)   /* ~15 ppm of sidereal */
+
+static volatile unsigned char track_rate = TRACK_SIDEREAL;
+static volatile UINT16 track_custom = TRACK_CUSTOM_ONE;
+static volatile UINT16 track_offset = 0;        /* signed */
+static volatile unsigned long track_incr = INCR_SIDEREAL;
+
+void
+track_poll (void)
+{
+    static char init = 0;
+    static unsigned char rate;
+    static UINT16 custom, offset;
+    unsigned long incr;
+    long off, v;
+
+    SSPIE = 0;
+    if (init && rate == track_rate && custom == track_custom
+             && offset == track_offset) {
+        SSPIE = 1;
+        return;
+    }
+    rate = track_rate;
+    custom = track_custom;
+    offset = track_offset;
+    SSPIE = 1;
+    init = 1;
+    switch (rate) {
+        case TRACK_LUNAR:
+            incr = INCR_LUNAR;
+            break;
+        case TRACK_SOLAR:
+            incr = INCR_SOLAR;
+            break;
+        case TRACK_CUSTOM:      /* INCR_SIDEREAL * custom / 2^15 */
+            incr = (INCR_SIDEREAL >> 15) * custom
+                 + (((INCR_SIDEREAL & 0x7fff) * custom) >> 15);
+            break;
+        default:
+            incr = INCR_SIDEREAL;
+            break;
+    }
+    off = (offset & 0x8000) ? (long)offset - 0x10000L : (long)offset;
+    v = (long)incr + off * (long)TRACK_OFFSET_UNIT;
+    if (v < (long)INCR_EAST)
+        v = INCR_EAST;
+    if (v > (long)INCR_WEST)
+        v = INCR_WEST;
+    TMR2IE = 0;
+    track_incr = v;
+    TMR2IE = 1;
+}
+
+/* Periodic error correction.  The worm revolution is divided into
+ * PEC_SEGMENTS segments, counted by pec_tic () at each drive cycle start.
+ * A revolution is not a whole number of drive cycles, so segment ends are
+ * found with a fractional accumulator: each cycle adds PEC_SEG_STEP and a
+ * segment ends when it reaches PEC_SEG_WRAP, so segments are 560 or 561
+ * cycles at 60 Hz and the table never slips against the worm.  While
+ * recording, the mean rate offset from the tracking rate over each
+ * segment (guide corrections from the handbox or ibuttons, plus any
+ * playback) is averaged into pec_table[] in units of PEC_UNIT.  Timed RA
+ * guide pulses bypass ac_incr_now, so guide_tic () counts their ticks in
+ * pec_guide_tics (+west, -east) and pec_poll () adds them to the mean.
+ * During playback the segment's offset is added to the tracking rate.
+ * There is no worm index sensor: the segment counter starts at zero and
+ * may be set over I2C to align with a saved table.
+ */
+#ifndef WORM_MS
+#define WORM_MS             598362UL    /* worm period: sidereal day / 144 */
+#endif
+#define PEC_SEGMENTS        64
+#define PEC_SEG_STEP        ((unsigned long)PEC_SEGMENTS * 1000)
+#define PEC_SEG_WRAP        ((unsigned long)MOTOR_HZ * WORM_MS)
+#define PEC_UNIT            ((long)(INCR_SIDEREAL >> 10)) /* ~0.1% sidereal */
+#define PEC_CLAMP           (127L * PEC_UNIT)       /* keeps pec_sum in range */
+#define PEC_GUIDE_UNITS     ((long)(INCR_WEST - INCR_SIDEREAL) / PEC_UNIT)
+
+#define PEC_EE_MAGIC        0xa5
+#define PEC_EE_ADDR         0x00    /* magic, then table */
+
+typedef enum {
+    PEC_OFF=0, PEC_PLAY=1, PEC_RECORD=2, PEC_RECORD_START=3,
+} pec_mode_t;
+typedef enum {
+    PEC_CMD_NONE=0, PEC_CMD_OFF=1, PEC_CMD_PLAY=2, PEC_CMD_RECORD=3,
+    PEC_CMD_SAVE=4, PEC_CMD_LOAD=5, PEC_CMD_CLEAR=6,
+} pec_cmd_t;
+
+static persistent signed char pec_table[PEC_SEGMENTS];   /* see warm_tic */
+static unsigned char pec_table_check;           /* pec_table_sum (), main */
+static volatile char pec_valid = 0;             /* table holds a recording */
+static volatile unsigned char pec_mode = PEC_OFF;
+static volatile unsigned char pec_cmd = PEC_CMD_NONE;
+static volatile unsigned char pec_seg = 0;
+static volatile unsigned long pec_seg_acc = 0;
+static volatile UINT16 pec_seg_cycles = 0;      /* in this segment */
+static long pec_sum = 0;
+static long pec_guide_tics = 0;                 /* guide_tic () */
+static volatile long pec_done_sum;              /* handoff to pec_poll () */
+static volatile long pec_done_guide;
+static volatile UINT16 pec_done_cycles;
+static volatile unsigned char pec_done_seg;
+static volatile char pec_done = 0;             /* 1=segment, 2=last */
+static unsigned char pec_nrecorded = 0;
+
+/* Called from ac_interrupt () at the start of each drive cycle.
+ */
+void
+pec_tic (void)
+{
+    long d;
+
+    if (pec_mode == PEC_RECORD) {
+        d = (long)(ac_incr_now - track_incr);
+        if (d > PEC_CLAMP)
+            d = PEC_CLAMP;
+        if (d < -PEC_CLAMP)
+            d = -PEC_CLAMP;
+        pec_sum += d;
+    }
+    pec_seg_cycles++;
+    pec_seg_acc += PEC_SEG_STEP;
+    if (pec_seg_acc < PEC_SEG_WRAP)
+        return;
+    pec_seg_acc -= PEC_SEG_WRAP;
+    if (pec_mode == PEC_RECORD) {
+        pec_done_sum = pec_sum;
+        pec_done_guide = pec_guide_tics;
+        pec_done_cycles = pec_seg_cycles;
+        pec_done_seg = pec_seg;
+        pec_done = 1;
+        if (++pec_nrecorded == PEC_SEGMENTS) {
+            pec_done = 2;
+            pec_mode = PEC_PLAY;
+        }
+    } else if (pec_mode == PEC_RECORD_START) {
+        pec_nrecorded = 0;
+        pec_mode = PEC_RECORD;
+    }
+    pec_sum = 0;
+    pec_guide_tics = 0;
+    pec_seg_cycles = 0;
+    pec_seg = (pec_seg + 1) & (PEC_SEGMENTS - 1);
+}
+
+/* Rate offset to add to the tracking rate for the current worm segment.
+ */
+long
+pec_offset (void)
+{
+    if (!pec_valid || pec_mode == PEC_OFF)
+        return 0;
+    return (long)pec_table[pec_seg] * PEC_UNIT;
+}
+
+void
+pec_save (void)
+{
+    unsigned char i;
+
+    eeprom_write (PEC_EE_ADDR, 0);
+    for (i = 0; i < PEC_SEGMENTS; i++)
+        eeprom_write (PEC_EE_ADDR + 1 + i, pec_table[i]);
+    eeprom_write (PEC_EE_ADDR, PEC_EE_MAGIC);
+}
+
+/* Checksum of pec_table[], taken by pec_poll () each main loop pass so
+ * warm_tic () can save it without looping in the interrupt.
+ */
+unsigned char
+pec_table_sum (void)
+{
+    unsigned char c = PEC_EE_MAGIC, i;
+
+    for (i = 0; i < PEC_SEGMENTS; i++)
+        c ^= pec_table[i];
+    return c;
+}
+
+char
+pec_load (void)
+{
+    unsigned char i;
+
+    if (eeprom_read (PEC_EE_ADDR) != PEC_EE_MAGIC)
+        return 0;
+    for (i = 0; i < PEC_SEGMENTS; i++)
+        pec_table[i] = eeprom_read (PEC_EE_ADDR + 1 + i);
+    return 1;
+}
+
+/* Called from the main loop: fold finished segments into the table and
+ * run commands from pec-ctl, which may block on EEPROM writes.
+ */
+void
+pec_poll (void)
+{
+    long m, n, g;
+    unsigned char i, cmd;
+    char done;
+
+    if (pec_done) {
+        TMR2IE = 0;
+        m = pec_done_sum;
+        g = pec_done_guide;
+        n = pec_done_cycles;
+        i = pec_done_seg;
+        done = pec_done;
+        pec_done = 0;
+        TMR2IE = 1;
+        if (n > 0) {
+            m /= n * PEC_UNIT;
+            /* guide ticks to PEC_UNITs per drive cycle, kept in range */
+            m += g * PEC_GUIDE_UNITS / n * MOTOR_HZ / AC_TICK_HZ;
+        }
+        if (m > 127)
+            m = 127;
+        if (m < -127)
+            m = -127;
+        pec_table[i] = pec_valid ? (pec_table[i] + m) / 2 : m;
+        if (done == 2)
+            pec_valid = 1;      /* full worm revolution recorded */
+    }
+    GIE = 0;
+    cmd = pec_cmd;
+    pec_cmd = PEC_CMD_NONE;
+    GIE = 1;
+    switch (cmd) {
+        case PEC_CMD_OFF:
+            pec_mode = PEC_OFF;
+            break;
+        case PEC_CMD_PLAY:
+            pec_mode = PEC_PLAY;
+            break;
+        case PEC_CMD_RECORD:
+            pec_mode = PEC_RECORD_START;
+            break;
+        case PEC_CMD_SAVE:
+            if (pec_valid)
+                pec_save ();
+            break;
+        case PEC_CMD_LOAD:
+            pec_valid = pec_load ();
+            break;
+        case PEC_CMD_CLEAR:
+            for (i = 0; i < PEC_SEGMENTS; i++)
+                pec_table[i] = 0;
+            pec_valid = 0;
+            break;
+    }
+    pec_table_check = pec_table_sum ();
+}
+
+/* Warm restart.  The drive state is kept in persistent RAM (not cleared
+ * by the C startup code), checked by warm_check.  After a brown-out or
+ * watchdog reset with valid state, the drive resumes at the saved rate
+ * (and tracking selection) after AC_WARM_TICS instead of starting at the
+ * east rate behind the AC_STARTUP_TICS output inhibit.  Other resets
+ * (MCLR, RESET instruction, stack fault) are counted but start cold, as
+ * the saved state may be what went wrong.  pec_table[] is persistent too,
+ * and PEC carries on in its saved mode if the table still matches the
+ * checksum saved with it; otherwise it starts from EEPROM as after
+ * power-on.  A recording in progress starts over at the next segment.
+ */
+typedef enum {
+    RESET_POR=0, RESET_BOR=1, RESET_WDT=2, RESET_OTHER=3,
+} reset_t;
+#define WARM_MAGIC          0x5a
+
+static persistent unsigned long warm_incr;
+static persistent unsigned long warm_special;
+static persistent unsigned char warm_mode;
+static persistent unsigned char warm_seg;
+static persistent unsigned char warm_track_rate;
+static persistent unsigned char warm_pec_mode;
+static persistent unsigned char warm_pec_valid;
+static persistent unsigned char warm_pec_check;
+static persistent UINT16 warm_track_custom;
+static persistent UINT16 warm_track_offset;
+static persistent unsigned char warm_check;
+static persistent UINT16 reset_count[RESET_OTHER + 1];
+static unsigned char reset_cause = RESET_POR;
+
+unsigned char
+warm_sum (void)
+{
+    unsigned char c = WARM_MAGIC ^ warm_mode ^ warm_seg ^ warm_track_rate
+                    ^ warm_pec_mode ^ warm_pec_valid ^ warm_pec_check;
+    unsigned char i;
+
+    for (i = 0; i < 32; i += 8)
+        c ^= (unsigned char)(warm_incr >> i)
+           ^ (unsigned char)(warm_special >> i);
+    for (i = 0; i < 16; i += 8)
+        c ^= (unsigned char)(warm_track_custom >> i)
+           ^ (unsigned char)(warm_track_offset >> i);
+    return c;
+}
+
+/* Called from ac_interrupt () at the start of each drive cycle.
+ */
+void
+warm_tic (void)
+{
+    warm_incr = ac_incr_now;
+    warm_special = ac_incr_special;
+    warm_mode = ac_mode;
+    warm_seg = pec_seg;
+    warm_track_rate = track_rate;
+    warm_track_custom = track_custom;
+    warm_track_offset = track_offset;
+    warm_pec_mode = pec_mode;
+    warm_pec_valid = pec_valid;
+    warm_pec_check = pec_table_check;
+    warm_check = warm_sum ();
+}
+
+/* Put back the saved drive state.  Returns 1 if the PEC state was put
+ * back too.
+ */
+char
+warm_resume (void)
+{
+    ac_incr_now = warm_incr;
+    ac_incr_special = warm_special;
+    ac_mode_targ = warm_mode;
+    pec_seg = warm_seg & (PEC_SEGMENTS - 1);
+    track_rate = warm_track_rate <= TRACK_CUSTOM ? warm_track_rate
+                                                 : TRACK_SIDEREAL;
+    track_custom = warm_track_custom;
+    track_offset = warm_track_offset;
+    ac_startup_tics = AC_WARM_TICS;
+    if (warm_pec_check != pec_table_sum ())
+        return 0;
+    pec_valid = warm_pec_valid ? 1 : 0;
+    if (warm_pec_mode == PEC_RECORD)
+        pec_mode = PEC_RECORD_START;
+    else if (warm_pec_mode <= PEC_RECORD_START)
+        pec_mode = warm_pec_mode;
+    return 1;
+}
+
+/* Called once from main () before interrupts are enabled.  Classifies the
+ * reset from RCON (POR and BOR must be set again by software) and restores
+ * the drive state if this is a warm restart.  Returns 1 if the PEC state
+ * was restored too, else the table is cleared for pec_load ().
+ */
+char
+warm_restart (void)
+{
+    unsigned char i;
+    char pec = 0;
 
+    if (!RCONbits.NOT_POR)
+        reset_cause = RESET_POR;
+    else if (!RCONbits.NOT_BOR)
+        reset_cause = RESET_BOR;
+    else if (!RCONbits.NOT_TO)
+        reset_cause = RESET_WDT;
+    else
+        reset_cause = RESET_OTHER;
+    RCONbits.NOT_POR = 1;
+    RCONbits.NOT_BOR = 1;
+
+    if (reset_cause == RESET_POR) {
+        for (i = 0; i <= RESET_OTHER; i++)
+            reset_count[i] = 0;
+        warm_check = ~warm_sum ();
+    } else {
+        reset_count[reset_cause]++;
+        if (reset_cause != RESET_OTHER && warm_check == warm_sum ())
+            pec = warm_resume ();
+    }
+    if (!pec) {
+        for (i = 0; i < PEC_SEGMENTS; i++)
+            pec_table[i] = 0;
+    }
+    pec_table_check = pec_table_sum ();
+    return pec;
+}
+
+/* Timed guide pulses written over I2C (guide-ra, guide-dec) are counted
+ * down in AC ticks, so they end within one tick (100us) of the requested
+ * length regardless of main loop or I2C timing.  An RA pulse adds the
+ * east or west rate offset straight into the phase advance, bypassing the
+ * rate ramp.  A DEC pulse drives GONORTH/GOSOUTH from the interrupt;
+ * action () leaves them alone while guide_buttons is set.  The count is
+ * kept as whole ms plus ticks within the ms, so reading back the time
+ * remaining in reg_snapshot () needs no division.
+ */
+#define GUIDE_REVERSE       0x8000  /* east (ra) or south (dec) */
+#define GUIDE_MAX_MS        0x7fff
+#define GUIDE_TICS_PER_MS   (AC_TICK_HZ / 1000)
+
+static volatile UINT16 guide_ra_ms = 0;
+static volatile UINT16 guide_dec_ms = 0;
+static volatile unsigned char guide_ra_sub = 0; /* tics left in this ms */
+static volatile unsigned char guide_dec_sub = 0;
+static volatile char guide_ra_rev = 0;
+static volatile char guide_dec_rev = 0;
+static volatile char guide_buttons = 0;         /* dec pulse in progress */
+
+/* Called from reg_set () (i2c interrupt) with a register value.
+ */
 void
-ac_set_freq (char freq)
+guide_start_ra (UINT16 val)
 {
-    if (freq <= FREQ_WEST)
-        ac_freq_targ = freq;
+    guide_ra_rev = (val & GUIDE_REVERSE) ? 1 : 0;
+    guide_ra_sub = GUIDE_TICS_PER_MS;
+    guide_ra_ms = val & GUIDE_MAX_MS;
 }
-char 
-ac_get_freq (void)
+
+void
+guide_start_dec (UINT16 val)
+{
+    guide_dec_rev = (val & GUIDE_REVERSE) ? 1 : 0;
+    guide_dec_sub = GUIDE_TICS_PER_MS;
+    guide_dec_ms = val & GUIDE_MAX_MS;
+    if (output_inhibit
+            || ((buttons | ibuttons) & (BUTTON_NORTH|BUTTON_SOUTH))) {
+        guide_dec_ms = 0;       /* dec is under manual control */
+        guide_buttons = 0;
+    } else if (guide_dec_ms == 0) {
+        guide_buttons = 0;
+        GONORTH = 0;
+        NOP ();
+        GOSOUTH = 0;
+    } else if (guide_dec_rev) {
+        guide_buttons = BUTTON_SOUTH;
+        GONORTH = 0;
+        NOP ();
+        GOSOUTH = 1;
+    } else {
+        guide_buttons = BUTTON_NORTH;
+        GONORTH = 1;
+        NOP ();
+        GOSOUTH = 0;
+    }
+}
+
+UINT16
+guide_remaining (UINT16 ms, char rev)
 {
-    return ac_freq_now;
+    return ms == 0 ? 0 : rev ? ms | GUIDE_REVERSE : ms;
 }
 
-#define FUDGE_COUNT 500 /* FIXME shouldn't need this */
+/* Called from ac_interrupt () every tick.  Returns the RA phase increment
+ * offset for this tick.
+ */
+long
+guide_tic (void)
+{
+    long offset = 0;
 
+    if (guide_dec_ms > 0 && --guide_dec_sub == 0) {
+        guide_dec_sub = GUIDE_TICS_PER_MS;
+        if (--guide_dec_ms == 0 && guide_buttons) {
+            guide_buttons = 0;
+            GONORTH = 0;
+            NOP ();
+            GOSOUTH = 0;
+        }
+    }
+    if (guide_ra_ms > 0) {
+        if (--guide_ra_sub == 0) {
+            guide_ra_sub = GUIDE_TICS_PER_MS;
+            guide_ra_ms--;
+        }
+        if (guide_ra_rev)
+            offset = (long)INCR_EAST - (long)INCR_SIDEREAL;
+        else
+            offset = (long)INCR_WEST - (long)INCR_SIDEREAL;
+        if (pec_mode == PEC_RECORD)
+            pec_guide_tics += guide_ra_rev ? -1 : 1;
+    }
+    return offset;
+}
+
+/* Move ac_incr_now toward the target, called every tick.  For the S-curve,
+ * step is a multiple of ac_jerk and stop is the distance covered while
+ * braking from it, so braking starts in time to arrive with step at zero.
+ */
+void
+ac_ramp (void)
+{
+    static unsigned long step = 0;
+    static unsigned long stop = 0;
+    static char up = 0;
+    unsigned long targ, d;
+    char want_up;
+
+    targ = ac_incr_special ? ac_incr_special : ac_incr_targ;
+    if (ac_incr_now == targ) {
+        step = stop = 0;
+        return;
+    }
+    want_up = targ > ac_incr_now;
+    d = want_up ? targ - ac_incr_now : ac_incr_now - targ;
+    if (ac_profile == AC_PROFILE_LINEAR) {
+        step = ac_accel;
+        stop = 0;
+        up = want_up;
+    } else if (step == 0) {
+        up = want_up;
+        step = ac_jerk;
+        stop = 0;
+    } else if (up != want_up || d < step + stop + step + ac_jerk
+                             || step + ac_jerk > ac_accel) {
+        if (up != want_up || d < step + stop) {
+            if (step <= ac_jerk)        /* brake */
+                step = stop = 0;
+            else {
+                step -= ac_jerk;
+                stop = stop > step ? stop - step : 0;
+            }
+        }
+    } else {
+        stop += step;                   /* accelerate */
+        step += ac_jerk;
+    }
+    if (up == want_up && step >= d) {
+        ac_incr_now = targ;
+        step = stop = 0;
+    } else if (up)
+        ac_incr_now += step;
+    else
+        ac_incr_now -= step;
+}
+
+/* The quarter cycle for a tick is computed in the previous tick, so
+ * outputs change at a fixed delay after the period match regardless of
+ * how long the rest of ac_interrupt () takes.
+ */
 void
 ac_interrupt (void)
 {
-    static char state = 0;
-    static int startup_delay = 0;
+    static unsigned long phase = 0;
+    static unsigned char state = 0;
+    static unsigned char next = 0;
+    static UINT16 startup_delay = 0;
 
-    if (startup_delay < 1000)
+    if (next != state) {
+        state = next;
+        switch (state) {
+            case 0:
+                if (ac_mode != ac_mode_targ)
+                    ac_set_mode (ac_mode_targ);
+                if (!output_inhibit) {
+                    SQWAVE = 1;
+                    NOP ();
+                    if (ac_mode == AC_MODE_SQUARE)
+                        PHASE1 = 1;
+                }
+                pec_tic ();
+                warm_tic ();
+                break;
+            case 1:
+                if (!output_inhibit)
+                    PHASE1 = 0;
+                break;
+            case 2:
+                if (!output_inhibit) {
+                    SQWAVE = 0;
+                    NOP ();
+                    if (ac_mode == AC_MODE_SQUARE)
+                        PHASE2 = 1;
+                }
+                break;
+            case 3:
+                if (!output_inhibit)
+                    PHASE2 = 0;
+                break;
+        }
+    }
+    if (startup_delay < ac_startup_tics)
         startup_delay++;
     else
         output_inhibit = 0;
-    switch (state) {
-        case 0:
-            if (!output_inhibit) {
-                SQWAVE = 1;
-                NOP ();
-                PHASE1 = 1;
-            }
-            state = 1;
-            break;
-        case 1:
-            if (!output_inhibit)
-                PHASE1 = 0;
-            state = 2;
-            break;
-        case 2:
-            if (!output_inhibit) {
-                SQWAVE = 0;
-                NOP ();
-                PHASE2 = 1;
-            }
-            state = 3;
-            break;
-        case 3:
-            if (!output_inhibit)
-                PHASE2 = 0;
-            state = 0;
-            /* Cycle completed - change timer count? */
-            if (ac_freq_now < ac_freq_targ)
-                ac_freq_now++;
-            else if (ac_freq_now > ac_freq_targ)
-                ac_freq_now--;
-            break;
+    ac_ramp ();
+    phase += ac_incr_now + guide_tic ();
+    next = (unsigned char)(phase >> 24) >> 6;
+    if (ac_mode == AC_MODE_SINE && !output_inhibit) {
+        /* buffered: both take effect at the next PWM period (tick)
+         * phase bits 30:25 index the half cycle in AC_SINE_STEPS (64)
+         */
+        CCPR1L = ac_sine[((unsigned char)(phase >> 24) >> 1) & 0x3f];
+        PSTRCON = next < 2 ? PSTRCON_PHASE1 : PSTRCON_PHASE2;
     }
-    if (ac_count_special)
-        TMR0 = ac_count_special;
-    else
-        TMR0 = freq[ac_freq_now] + FUDGE_COUNT;
+    if (ac_mode == AC_MODE_SINE)
+        dc_sw_tic ();
+}
+
+/* Interrupt latency.  Timer1 runs free at the instruction clock, started
+ * together with Timer2, so Timer2 period matches fall at multiples of
+ * AC_TICK_COUNT on Timer1.  isr () reads Timer1 on entry and lat_tic ()
+ * compares it with the expected match, keeping statistics of latency
+ * and of the entry-to-entry period error, in instruction cycles, and a
+ * histogram of latency in powers of two microseconds.  Ticks missed
+ * outright are counted separately.  Latency is under AC_TICK_COUNT, so
+ * lat_sum cannot wrap while lat_count is below LAT_COUNT_MAX; there both
+ * are halved, and the mean goes on favouring the last few minutes.
+ */
+#define LAT_HIST_BINS       8       /* <1us, <2us, ... <64us, more */
+#define LAT_CYCLES_PER_US   (_XTAL_FREQ / 4000000)
+#define LAT_COUNT_MAX       (0xffffffffUL / AC_TICK_COUNT)
+
+static UINT16 lat_expect = 0;
+static UINT16 lat_last = 0;
+static volatile UINT16 lat_min, lat_max;
+static volatile int lat_perr_min, lat_perr_max;
+static volatile unsigned long lat_sum, lat_count;
+static volatile UINT16 lat_missed;
+static volatile UINT16 lat_hist[LAT_HIST_BINS];
+static volatile UINT16 lat_mean = 0;            /* lat_poll () */
+static volatile char lat_reset = 1;
+
+void
+lat_tic (UINT16 t1)
+{
+    UINT16 lat = t1 - lat_expect;
+    unsigned char bin = 0, i;
+    UINT16 us;
+    int perr;
+
+    while (lat >= AC_TICK_COUNT) {      /* missed a tick */
+        lat_expect += AC_TICK_COUNT;
+        lat -= AC_TICK_COUNT;
+        if (!lat_reset && lat_missed < 0xffff)
+            lat_missed++;
+    }
+    lat_expect += AC_TICK_COUNT;
+    perr = lat_reset ? 0 : (int)(lat - lat_last);
+    lat_last = lat;
+    if (lat_reset) {
+        lat_min = lat_max = lat;
+        lat_perr_min = lat_perr_max = 0;
+        lat_sum = lat_count = 0;
+        lat_missed = 0;
+        for (i = 0; i < LAT_HIST_BINS; i++)
+            lat_hist[i] = 0;
+        lat_reset = 0;
+    }
+    if (lat < lat_min)
+        lat_min = lat;
+    if (lat > lat_max)
+        lat_max = lat;
+    if (perr < lat_perr_min)
+        lat_perr_min = perr;
+    if (perr > lat_perr_max)
+        lat_perr_max = perr;
+    if (lat_count >= LAT_COUNT_MAX) {
+        lat_sum >>= 1;
+        lat_count >>= 1;
+    }
+    lat_sum += lat;
+    lat_count++;
+    for (us = lat / LAT_CYCLES_PER_US; us > 0 && bin < LAT_HIST_BINS - 1;
+                                                                    us >>= 1)
+        bin++;
+    if (lat_hist[bin] < 0xffff)
+        lat_hist[bin]++;
 }
 
-typedef enum {REG_BUTTONS=0, REG_AC_COUNT=1} i2c_reg_t;
+/* Called from the main loop: update lat_mean without dividing in isr ().
+ */
+void
+lat_poll (void)
+{
+    unsigned long sum, count;
+
+    TMR2IE = 0;
+    sum = lat_sum;
+    count = lat_count;
+    TMR2IE = 1;
+    if (count > 0) {
+        sum /= count;
+        SSPIE = 0;
+        lat_mean = sum;
+        SSPIE = 1;
+    }
+}
+
+/* 32-bit values span two registers; writing the MSW commits the value.
+ */
+typedef enum {
+    REG_BUTTONS=0, REG_AC_INCR_LSW=1, REG_AC_INCR_MSW=2, REG_AC_MODE=3,
+    REG_PEC_CTL=4, REG_PEC_SEG=5, REG_PEC_INDEX=6, REG_PEC_DATA=7,
+    REG_GUIDE_RA=8, REG_GUIDE_DEC=9, REG_AC_ACCEL=10, REG_AC_PROFILE=11,
+    REG_DEC_DUTY=12, REG_FOCUS_DUTY=13, REG_DC_SPEED=14, REG_SEQ=15,
+    REG_RESET_CAUSE=16, REG_RESET_BOR=17, REG_RESET_WDT=18, REG_RESET_OTHER=19,
+    REG_LAT_CTL=20, REG_LAT_MIN=21, REG_LAT_MAX=22, REG_LAT_MEAN=23,
+    REG_LAT_PERR_MIN=24, REG_LAT_PERR_MAX=25, REG_LAT_MISSED=26,
+    REG_LAT_HIST=27,                    /* LAT_HIST_BINS registers */
+    REG_TRACK_RATE=REG_LAT_HIST + LAT_HIST_BINS,
+    REG_TRACK_CUSTOM, REG_TRACK_OFFSET,
+    REG_COUNT
+} i2c_reg_t;
+static UINT16 reg_snap[REG_COUNT];
+static volatile UINT16 reg_seq = 0;     /* main loop passes */
+static unsigned char pec_index = 0;
+static UINT16 reg_lsw = 0;
 void
 reg_set (unsigned char regnum, unsigned char val, regbyte_t sel)
 {
+    static unsigned char lsb;
+
     switch (regnum) {
         case REG_BUTTONS:
             if (sel == REG_LSB)
                 ibuttons = val;
             break;
-        case REG_AC_COUNT:
+        case REG_AC_INCR_LSW:
+            if (sel == REG_LSB)
+                reg_lsw = val;
+            else
+                reg_lsw |= (UINT16)val<<8;
+            break;
+        case REG_AC_INCR_MSW:
+            if (sel == REG_LSB)
+                lsb = val;
+            else
+                ac_incr_special = ((unsigned long)val<<24)
+                                | ((unsigned long)lsb<<16) | reg_lsw;
+            break;
+        case REG_AC_MODE:
+            if (sel == REG_LSB && val <= AC_MODE_SINE)
+                ac_mode_targ = val;
+            break;
+        case REG_PEC_CTL:
+            if (sel == REG_LSB && val <= PEC_CMD_CLEAR)
+                pec_cmd = val;
+            break;
+        case REG_PEC_SEG:
+            if (sel == REG_LSB) {
+                pec_seg = val & (PEC_SEGMENTS - 1);
+                pec_seg_acc = 0;
+                pec_seg_cycles = 0;
+            }
+            break;
+        case REG_PEC_INDEX:
             if (sel == REG_LSB)
-                ac_count_special = val;
+                pec_index = val & (PEC_SEGMENTS - 1);
+            break;
+        case REG_PEC_DATA:
+            if (sel == REG_LSB) {
+                pec_table[pec_index] = val;
+                pec_index = (pec_index + 1) & (PEC_SEGMENTS - 1);
+                pec_valid = 1;
+            }
+            break;
+        case REG_GUIDE_RA:
+            if (sel == REG_LSB)
+                lsb = val;
+            else
+                guide_start_ra (((UINT16)val<<8) | lsb);
+            break;
+        case REG_GUIDE_DEC:
+            if (sel == REG_LSB)
+                lsb = val;
+            else
+                guide_start_dec (((UINT16)val<<8) | lsb);
+            break;
+        case REG_AC_ACCEL:
+            if (sel == REG_LSB)
+                lsb = val;
+            else if (val != 0 || lsb != 0)
+                ac_accel_hz = ((UINT16)val<<8) | lsb;
+            break;
+        case REG_AC_PROFILE:
+            if (sel == REG_LSB && val <= AC_PROFILE_SCURVE)
+                ac_profile = val;
+            break;
+        case REG_DEC_DUTY:
+        case REG_FOCUS_DUTY:
+            if (val > 100)
+                val = 100;
+            dc_duty[regnum == REG_DEC_DUTY ? DC_DEC : DC_FOCUS]
+                   [sel == REG_LSB ? DC_FAST : DC_SLOW] = val;
+            break;
+        case REG_DC_SPEED:
+            if (sel == REG_LSB && val <= DC_SLOW)
+                dc_speed = val;
+            break;
+        case REG_RESET_BOR:
+        case REG_RESET_WDT:
+        case REG_RESET_OTHER:
+            if (sel == REG_LSB)         /* any write clears */
+                reset_count[regnum - REG_RESET_BOR + RESET_BOR] = 0;
+            break;
+        case REG_LAT_CTL:
+            if (sel == REG_LSB && val == 1)
+                lat_reset = 1;
+            break;
+        case REG_TRACK_RATE:
+            if (sel == REG_LSB && val <= TRACK_CUSTOM)
+                track_rate = val;
+            break;
+        case REG_TRACK_CUSTOM:
+            if (sel == REG_LSB)
+                lsb = val;
+            else
+                track_custom = ((UINT16)val<<8) | lsb;
+            break;
+        case REG_TRACK_OFFSET:
+            if (sel == REG_LSB)
+                lsb = val;
             else
-                ac_count_special |= (UINT16)val<<8;
+                track_offset = ((UINT16)val<<8) | lsb;
             break;
     }
 }
-unsigned char
-reg_get (unsigned char regnum, regbyte_t sel)
+UINT16
+reg_value (unsigned char regnum)
 {
-    unsigned char val = 0;
-    UINT16 count;
+    UINT16 val = 0;
 
     switch (regnum) {
         case REG_BUTTONS:
-            if (sel == REG_LSB)
-                val = buttons;
+            val = (unsigned char)buttons;
             break;
-        case REG_AC_COUNT:
-            count = ac_count_special ? ac_count_special : freq[ac_freq_now];
-            if (sel == REG_LSB)
-                val = count & 0xff;
-            else
-                val = (count >> 8) & 0xff;
+        case REG_AC_INCR_LSW:
+            val = ac_incr_now & 0xffff;
+            break;
+        case REG_AC_INCR_MSW:
+            val = ac_incr_now >> 16;
+            break;
+        case REG_AC_MODE:
+            val = ac_mode;
+            break;
+        case REG_PEC_CTL:
+            val = ((UINT16)pec_valid<<8) | pec_mode;
+            break;
+        case REG_PEC_SEG:
+            val = pec_seg;
+            break;
+        case REG_PEC_INDEX:
+            val = pec_index;
+            break;
+        case REG_PEC_DATA:
+            val = (unsigned char)pec_table[pec_index];
+            break;
+        case REG_GUIDE_RA:
+            val = guide_remaining (guide_ra_ms, guide_ra_rev);
+            break;
+        case REG_GUIDE_DEC:
+            val = guide_remaining (guide_dec_ms, guide_dec_rev);
+            break;
+        case REG_AC_ACCEL:
+            val = ac_accel_hz;
+            break;
+        case REG_AC_PROFILE:
+            val = ac_profile;
+            break;
+        case REG_DEC_DUTY:
+            val = ((UINT16)dc_duty[DC_DEC][DC_SLOW]<<8)
+                | dc_duty[DC_DEC][DC_FAST];
+            break;
+        case REG_FOCUS_DUTY:
+            val = ((UINT16)dc_duty[DC_FOCUS][DC_SLOW]<<8)
+                | dc_duty[DC_FOCUS][DC_FAST];
+            break;
+        case REG_DC_SPEED:
+            val = dc_speed;
+            break;
+        case REG_SEQ:
+            val = reg_seq;
+            break;
+        case REG_RESET_CAUSE:
+            val = ((UINT16)(ac_startup_tics == AC_WARM_TICS)<<8) | reset_cause;
+            break;
+        case REG_RESET_BOR:
+        case REG_RESET_WDT:
+        case REG_RESET_OTHER:
+            val = reset_count[regnum - REG_RESET_BOR + RESET_BOR];
+            break;
+        case REG_LAT_CTL:
+            val = lat_count > 0xffff ? 0xffff : lat_count;
+            break;
+        case REG_LAT_MIN:
+            val = lat_min;
+            break;
+        case REG_LAT_MAX:
+            val = lat_max;
+            break;
+        case REG_LAT_MEAN:
+            val = lat_mean;
+            break;
+        case REG_LAT_PERR_MIN:
+            val = lat_perr_min;
+            break;
+        case REG_LAT_PERR_MAX:
+            val = lat_perr_max;
+            break;
+        case REG_LAT_MISSED:
+            val = lat_missed;
+            break;
+        case REG_TRACK_RATE:
+            val = track_rate;
+            break;
+        case REG_TRACK_CUSTOM:
+            val = track_custom;
+            break;
+        case REG_TRACK_OFFSET:
+            val = track_offset;
+            break;
+        default:
+            if (regnum >= REG_LAT_HIST
+                    && regnum < REG_LAT_HIST + LAT_HIST_BINS)
+                val = lat_hist[regnum - REG_LAT_HIST];
             break;
     }
     return val;
 }
 
+/* Called by i2c_interrupt () when a read starts.  Interrupts are off, so
+ * all registers are sampled at one instant, and a read of any run of
+ * registers is coherent.  Each reg_value () case must stay a plain load,
+ * so this finishes well inside an AC tick.  first is the read's first
+ * register.
+ */
+static unsigned char reg_first = 0;
+
+void
+reg_snapshot (unsigned char first)
+{
+    unsigned char i;
+
+    reg_first = first;
+    for (i = 0; i < REG_COUNT; i++)
+        reg_snap[i] = reg_value (i);
+}
+
+unsigned char
+reg_get (unsigned char regnum, regbyte_t sel)
+{
+    if (regnum >= REG_COUNT)
+        return 0;
+    /* only a read that starts at pec-data steps the table index, so a
+     * burst passing over it leaves it alone */
+    if (regnum == REG_PEC_DATA && sel == REG_LSB && reg_first == REG_PEC_DATA)
+        pec_index = (pec_index + 1) & (PEC_SEGMENTS - 1);
+    return sel == REG_LSB ? reg_snap[regnum] & 0xff : reg_snap[regnum] >> 8;
+}
+
+/* The ADC scans the handbox channels from its conversion complete
+ * interrupt: each result is stored and the next channel started, until
+ * the scan is done.  A scan is started every ADC_SCAN_TICS AC ticks.
+ * The main loop only looks at finished scans (adc_seq changes).
+ */
+#define ADC_SCAN_TICS   10      /* 1 kHz */
+#define ADC_NCHAN       3
+static const unsigned char adc_chan[ADC_NCHAN] = {
+    ADC_EAST, ADC_SOUTH, ADC_WEST
+};
+static volatile UINT16 adc_result[ADC_NCHAN];
+static volatile unsigned char adc_index = ADC_NCHAN;   /* idle */
+static volatile unsigned char adc_seq = 0;
+
+void
+adc_tic (void)
+{
+    static unsigned char tics = 0;
+
+    if (++tics < ADC_SCAN_TICS || adc_index < ADC_NCHAN)
+        return;
+    tics = 0;
+    adc_index = 0;
+    ADCON0bits.CHS = adc_chan[0];       /* select input channel */
+    ADCON0bits.GO_DONE = 1;             /* acquire, then convert */
+}
+
+void
+adc_interrupt (void)
+{
+    adc_result[adc_index] = (((UINT16)ADRESH)<<8) | ADRESL;
+    if (++adc_index < ADC_NCHAN) {
+        ADCON0bits.CHS = adc_chan[adc_index];
+        ADCON0bits.GO_DONE = 1;
+    } else
+        adc_seq++;
+}
+
 void interrupt
 isr (void)
 {
-    if (TMR0IE && TMR0IF) {
+    UINT16 t1 = TMR1L;                  /* latches TMR1H (RD16) */
+
+    t1 |= (UINT16)TMR1H << 8;
+    if (TMR2IE && TMR2IF) {
+        lat_tic (t1);
         ac_interrupt ();
-        TMR0IF = 0;
+        adc_tic ();
+        TMR2IF = 0;
     }
     if (SSPIE && SSPIF) {
         i2c_interrupt ();
         SSPIF = 0;
     }
-}
-
-typedef enum { ADC_OFF, ADC_MID, ADC_ON } adc_t;
-/* voltages 0-5V scaled to 10b ADC resolution */
-#define SCALED_2V  409
-#define SCALED_4V  819
-adc_t
-adc_read (char chs)
-{
-    int result;
-    adc_t res;
-
-    ADCON0bits.CHS = chs;               /* select input channel */
-    ADCON0bits.GO_DONE = 1;             /* start conversion */
-    while (ADCON0bits.GO_DONE)          /* wait for result */
-        NOP ();
-    result = (((int)ADRESH)<<8) | ADRESL;
-    return (result < SCALED_2V ? ADC_OFF :
-            result > SCALED_4V ? ADC_ON : ADC_MID);
+    if (ADIE && ADIF) {
+        adc_interrupt ();
+        ADIF = 0;
+    }
 }
 
 #define DEBOUNCE_THRESH 10
@@ -228,6 +1251,35 @@ port_read_debounce (int *dbcount, char val)
     return res;
 }
 
+typedef enum { ADC_OFF, ADC_MID, ADC_ON } adc_t;
+/* voltages 0-5V scaled to 10b ADC resolution */
+#define SCALED_2V  409
+#define SCALED_4V  819
+adc_t
+adc_level (UINT16 result)
+{
+    return (result < SCALED_2V ? ADC_OFF :
+            result > SCALED_4V ? ADC_ON : ADC_MID);
+}
+
+/* Accept a new level once it has been seen DEBOUNCE_THRESH scans running.
+ */
+typedef struct {
+    adc_t       level;
+    adc_t       last;
+    int         count;
+} adc_db_t;
+adc_t
+adc_debounce (adc_db_t *db, adc_t val)
+{
+    if (val != db->last) {
+        db->last = val;
+        db->count = 0;
+    } else if (db->count < DEBOUNCE_THRESH && ++db->count == DEBOUNCE_THRESH)
+        db->level = val;
+    return db->level;
+}
+
 typedef enum { LED_OFF, LED_ON } led_t;
 void
 port_led_set (led_t val)
@@ -240,6 +1292,39 @@ port_led_toggle (void)
     LED = !LED;
 }
 
+void
+dc_set_pwm (unsigned char pct)
+{
+    unsigned char ccpr = (UINT16)pct * (AC_TICK_PR2 + 1) / 100;
+
+    if (pct == dc_pct)
+        return;
+    TMR2IE = 0;                 /* ac_set_mode () also writes CCPR1L */
+    dc_pct = pct;
+    dc_ccpr = ccpr;
+    if (ac_mode == AC_MODE_SQUARE)
+        CCPR1L = ccpr;
+    TMR2IE = 1;
+}
+
+void
+dc_update_pwm (void)
+{
+    unsigned char targ = 0;
+    unsigned char m;
+
+    for (m = DC_DEC; m <= DC_FOCUS; m++)
+        if (dc_running[m] && dc_duty[m][dc_speed] > targ)
+            targ = dc_duty[m][dc_speed];
+    if (!dc_running[DC_DEC] && !dc_running[DC_FOCUS]) {
+        dc_set_pwm (100);
+        return;
+    }
+    if (dc_soft < targ)
+        dc_soft += DC_SOFT_STEP;
+    dc_set_pwm (dc_soft < targ ? dc_soft : targ);
+}
+
 typedef enum { DEC_OFF, DEC_NORTH, DEC_SOUTH } dec_t;
 void
 dc_set_dec (dec_t want)
@@ -248,6 +1333,9 @@ dc_set_dec (dec_t want)
 
     if (cur == want || output_inhibit)
         return;
+    if (want != DEC_OFF)
+        dc_soft = 0;
+    dc_running[DC_DEC] = (want != DEC_OFF);
     switch (want) {
         case DEC_OFF:
             GONORTH = 0;
@@ -277,6 +1365,9 @@ dc_set_focus (focus_t want)
 
     if (cur == want || output_inhibit)
         return;
+    if (want != FOC_OFF)
+        dc_soft = 0;
+    dc_running[DC_FOCUS] = (want != FOC_OFF);
     switch (want) {
         case FOC_OFF:
             FOCIN = 0;
@@ -301,7 +1392,12 @@ void
 poll_buttons (void)
 {
     static int ncount = 0;
-    static int ecount = 0;
+    static adc_db_t db[ADC_NCHAN] = {
+        { ADC_ON, ADC_ON, 0 }, { ADC_ON, ADC_ON, 0 }, { ADC_ON, ADC_ON, 0 },
+    };
+    static unsigned char seq = 0;
+    unsigned char i;
+    UINT16 r;
     char b = 0;
 
     switch (port_read_debounce (&ncount, !SW_NORTH)) {
@@ -309,7 +1405,16 @@ poll_buttons (void)
             b |= BUTTON_NORTH;
             break;
     }
-    switch (adc_read (ADC_EAST)) {
+    if (seq != adc_seq) {
+        seq = adc_seq;
+        for (i = 0; i < ADC_NCHAN; i++) {
+            ADIE = 0;
+            r = adc_result[i];
+            ADIE = 1;
+            adc_debounce (&db[i], adc_level (r));
+        }
+    }
+    switch (db[0].level) {          /* ADC_EAST */
         case ADC_MID:
             b |= BUTTON_LAMP;
             break;
@@ -317,7 +1422,7 @@ poll_buttons (void)
             b |= BUTTON_EAST;
             break;
     }
-    switch (adc_read (ADC_SOUTH)) {
+    switch (db[1].level) {          /* ADC_SOUTH */
         case ADC_MID:
             b |= BUTTON_FOCIN;
             break;
@@ -325,7 +1430,7 @@ poll_buttons (void)
             b |= BUTTON_SOUTH;
             break;
     }
-    switch (adc_read (ADC_WEST)) {
+    switch (db[2].level) {          /* ADC_WEST */
         case ADC_MID:
             b |= BUTTON_FOCOUT;
             break;
@@ -339,8 +1444,13 @@ poll_buttons (void)
 void
 action (void)
 {
+    static unsigned char lamp = 0;
     unsigned char b = buttons | ibuttons;
 
+    if ((b & BUTTON_LAMP) && !lamp)
+        dc_speed = dc_speed == DC_FAST ? DC_SLOW : DC_FAST;
+    lamp = b & BUTTON_LAMP;
+
     if ((b & BUTTON_FOCIN))
         dc_set_focus (FOC_IN);
     else if (b & BUTTON_FOCOUT)
@@ -348,7 +1458,9 @@ action (void)
     else
         dc_set_focus (FOC_OFF);
 
-    if (b & BUTTON_NORTH)
+    if (guide_buttons)
+        ;                       /* guide_tic () owns the dec outputs */
+    else if (b & BUTTON_NORTH)
         dc_set_dec (DEC_NORTH);
     else if (b & BUTTON_SOUTH)
         dc_set_dec (DEC_SOUTH);
@@ -356,11 +1468,13 @@ action (void)
         dc_set_dec (DEC_OFF);
 
     if (b & BUTTON_EAST)
-        ac_set_freq (FREQ_EAST);
+        ac_set_incr (INCR_EAST);
     else if (b & BUTTON_WEST)
-        ac_set_freq (FREQ_WEST);
+        ac_set_incr (INCR_WEST);
     else
-        ac_set_freq (FREQ_SIDEREAL);
+        ac_set_incr (track_incr + pec_offset ());
+
+    dc_update_pwm ();
 }
 
 void
@@ -419,10 +1533,12 @@ main(void)
     ADCON2bits.ADFM = 1;        /* right justified output fmt */
     ADCON2bits.ACQT = 5;        /* 12 Tad time */
     ADCON0bits.ADON = 1;        /* enable adc */
+    ADIF = 0;
+    ADIE = 1;                   /* scan from adc interrupt */
 
     /* DC motor config
      */
-    PWM = 1;                    /* TODO: enable PWM - for now set high */
+    PWM = 1;                    /* enable when not steered to PWM */
     FOCIN = 0;
     FOCOUT = 0;
     GONORTH = 0;
@@ -433,20 +1549,41 @@ main(void)
     PHASE1 = 0;
     PHASE2 = 0;
     SQWAVE = 0;
-    T0CONbits.T0PS = 2;         /* set prescaler to 1:8 (see genfreq.c) */
-    PSA = 0;                    /* assign prescaler */
-    T0CS = 0;                   /* use instr cycle clock (CLOCK_FREQ/4) */
-    T08BIT = 0;                 /* 16 bit mode */
-    TMR0IE = 1;                 /* enable timer0 interrupt */
-    TMR0 = freq[ac_freq_now];   /* load count */
+    T2CONbits.T2CKPS = AC_TICK_T2CKPS; /* set prescaler (see genfreq.c) */
+    T2CONbits.TOUTPS = 0;       /* postscaler 1:1 */
+    PR2 = AC_TICK_PR2;          /* period in prescaled instr cycles - 1 */
+    TMR2 = 0;
+    CCPR1L = dc_ccpr;           /* dc motor PWM (see ac_set_mode) */
+    PSTRCON = PSTRCON_DC;
+    CCP1CON = CCP1CON_PWM;
+    ac_poll_accel ();
+    TMR2IE = 1;                 /* enable timer2 interrupt */
+
+    /* Resume the drive after a warm reset, else PEC table from EEPROM
+     */
+    if (!warm_restart () && (pec_valid = pec_load ()))
+        pec_mode = PEC_PLAY;
 
     PEIE = 1;                   /* enable peripheral interrupts */
     GIE = 1;                    /* enable global interrupts */
-    TMR0ON = 1;                 /* start timer0 */
+    T1CON = 0;                  /* timer1: instr clock, 1:1 */
+    T1CONbits.RD16 = 1;         /* 16-bit reads */
+    TMR1H = 0;
+    TMR1L = 0;
+    T1CONbits.TMR1ON = 1;       /* start timer1 and timer2 together */
+    TMR2ON = 1;                 /* start timer2 */
     for (;;) {
         poll_buttons ();
+        pec_poll ();
+        ac_poll_accel ();
+        track_poll ();
+        lat_poll ();
         action ();
         indicate ();
+        CLRWDT ();
+        SSPIE = 0;
+        reg_seq++;
+        SSPIE = 1;
         __delay_ms(1);
     }
 }
@@ -0,0 +1,104 @@
+/* htc.h - simulated PIC18F14K22 SFRs for building the firmware on a host */
+
+/* Only the registers and bits used by the base and aux firmware and
+ * i2c_slave.c are present.
+ * Each SFR and its bitfield view are separate variables, so the harness
+ * must use the same view as the firmware (pins are PORTxbits fields).
+ * Delays and SLEEP () call back into the harness, which advances
+ * simulated time and runs isr () (see basesim.c and simpic.c).  main ()
+ * is renamed so the harness can call it.
+ */
+
+#ifndef _SIM_HTC_H
+#define _SIM_HTC_H
+
+typedef unsigned short UINT16;
+
+#define _18F14K22       1
+#define interrupt
+#define main            firmware_main
+#define persistent
+#define NOP()
+#define CLRWDT()
+#define SLEEP()         sim_sleep ()
+#define __CONFIG(n,x)
+#define __delay_ms(x)   sim_delay_ms (x)
+
+void sim_delay_ms (unsigned int ms);
+void sim_sleep (void);
+unsigned char eeprom_read (unsigned char addr);
+void eeprom_write (unsigned char addr, unsigned char val);
+
+#ifdef SIM_DEFINE_SFRS
+#define SFR(name, fields) \
+        volatile unsigned char name; \
+        volatile struct { fields } name##bits;
+#define BIT(name)       volatile unsigned char name;
+#else
+#define SFR(name, fields) \
+        extern volatile unsigned char name; \
+        extern volatile struct { fields } name##bits;
+#define BIT(name)       extern volatile unsigned char name;
+#endif
+#define B(n)            unsigned n:1;
+#define F(n,w)          unsigned n:w;
+
+SFR(PORTA,  B(RA0)B(RA1)B(RA2)B(RA3)B(RA4)B(RA5))
+SFR(PORTB,  B(RB4)B(RB5)B(RB6)B(RB7))
+SFR(PORTC,  B(RC0)B(RC1)B(RC2)B(RC3)B(RC4)B(RC5)B(RC6)B(RC7))
+SFR(TRISA,  B(RA0)B(RA1)B(RA2)B(RA3)B(RA4)B(RA5))
+SFR(TRISB,  B(RB4)B(RB5)B(RB6)B(RB7))
+SFR(TRISC,  B(RC0)B(RC1)B(RC2)B(RC3)B(RC4)B(RC5)B(RC6)B(RC7))
+SFR(ANSEL,  B(ANS0)B(ANS1)B(ANS2)B(ANS3)B(ANS4)B(ANS5)B(ANS6)B(ANS7))
+SFR(ANSELH, B(ANS8)B(ANS9)B(ANS10)B(ANS11))
+SFR(WPUA,   B(WPUA0)B(WPUA1)B(WPUA2)B(WPUA3)B(WPUA4)B(WPUA5))
+SFR(WPUB,   B(WPUB4)B(WPUB5)B(WPUB6)B(WPUB7))
+SFR(IOCA,   B(IOCA0)B(IOCA1)B(IOCA2)B(IOCA3)B(IOCA4)B(IOCA5))
+SFR(IOCB,   B(IOCB4)B(IOCB5)B(IOCB6)B(IOCB7))
+SFR(INTCON, B(RABIF)B(INT0IF)B(TMR0IF)B(RABIE)B(INT0IE)B(TMR0IE))
+SFR(RCON,   B(NOT_BOR)B(NOT_POR)B(NOT_PD)B(NOT_TO)B(NOT_RI)B(SBOREN)B(IPEN))
+SFR(OSCCON, F(SCS,2)B(IOFS)B(OSTS)F(IRCF,3)B(IDLEN))
+SFR(T0CON,  F(T0PS,3)B(PSA)B(T0SE)B(T0CS)B(T08BIT)B(TMR0ON))
+SFR(TMR0L,  )
+SFR(T1CON,  B(TMR1ON)B(TMR1CS)B(T1SYNC)B(T1OSCEN)F(T1CKPS,2)B(T1RUN)B(RD16))
+SFR(TMR1L,  )
+SFR(TMR1H,  )
+SFR(T2CON,  F(T2CKPS,2)B(TMR2ON)F(TOUTPS,4))
+SFR(TMR2,   )
+SFR(PR2,    )
+SFR(CCP1CON,F(CCP1M,4)F(DC1B,2)F(P1M,2))
+SFR(CCPR1L, )
+SFR(PSTRCON,B(STRA)B(STRB)B(STRC)B(STRD)B(STRSYNC))
+SFR(ADCON0, B(ADON)B(GO_DONE)F(CHS,4))
+SFR(ADCON1, F(NVCFG,2)F(PVCFG,2))
+SFR(ADCON2, F(ADCS,3)F(ACQT,3)B(ADFM))
+SFR(ADRESH, )
+SFR(ADRESL, )
+SFR(SSPBUF, )
+SFR(SSPADD, )
+SFR(SSPSTAT,B(BF)B(UA)B(R_W)B(S)B(P)B(D_A)B(CKE)B(SMP))
+SFR(SSPCON1,F(SSPM,4)B(CKP)B(SSPEN)B(SSPOV)B(WCOL))
+SFR(SSPCON2,B(SEN)B(RSEN)B(PEN)B(RCEN)B(ACKEN)B(ACKDT)B(ACKSTAT)B(GCEN))
+
+BIT(GIE)
+BIT(PEIE)
+BIT(RABPU)
+BIT(TMR0IF)
+BIT(TMR2ON)
+BIT(TMR2IE)
+BIT(TMR2IF)
+BIT(SSPIE)
+BIT(SSPIF)
+BIT(ADIE)
+BIT(ADIF)
+
+#undef SFR
+#undef BIT
+#undef B
+#undef F
+
+#endif /* _SIM_HTC_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,295 @@
+/* simpic.c - simulated PIC18F14K22 hosting one firmware image */
+
+/* The firmware runs in its own thread.  Its __delay_ms () and SLEEP ()
+ * advance simulated time a millisecond at a time.  Timer2 interrupts at
+ * the rate its registers give (Timer1 is set at each one as basesim.c
+ * does), ADC conversions complete at once and read 5V (no handbox
+ * buttons), and all inputs idle high.  A pending I2C transfer is run at
+ * each millisecond boundary, raising SSPIF for each byte as the MSSP
+ * would (see basesim.c).  In realtime mode simulated milliseconds are
+ * paced by CLOCK_MONOTONIC; otherwise time stands still between
+ * transfers.
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include <string.h>
+
+#define SIM_DEFINE_SFRS
+#include "htc.h"
+#undef main
+#include "simpic.h"
+
+#ifndef SIMPIC_NAME
+#error SIMPIC_NAME must name the firmware image
+#endif
+
+#define INSTR_FREQ      16000000UL
+#define CYCLES_PER_MS   (INSTR_FREQ / 1000)
+#define ISR_ENTRY       40      /* cycles from period match to TMR1 read */
+
+void firmware_main (void);
+void isr (void);
+
+typedef struct {
+    unsigned char       addr;
+    const unsigned char *wbuf;
+    int                 wlen;
+    unsigned char       *rbuf;
+    int                 rlen;
+    int                 result;
+    int                 done;
+} xfer_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_t thread;
+static int started = 0;
+static int realtime = 1;
+static xfer_t *pending = NULL;
+
+static struct timespec next_ms;
+static unsigned long long now = 0;      /* instr cycles */
+static unsigned long long t2_next = 0;  /* next Timer2 interrupt, or 0 */
+static unsigned long long t1_start = 0; /* when Timer1 was turned on, or 0 */
+static unsigned char eeprom[256];
+
+unsigned char
+eeprom_read (unsigned char addr)
+{
+    return eeprom[addr];
+}
+
+void
+eeprom_write (unsigned char addr, unsigned char val)
+{
+    eeprom[addr] = val;
+}
+
+static void
+sim_isr (void)
+{
+    if (GIE && PEIE)
+        isr ();
+}
+
+static void
+adc_run (void)
+{
+    int n;
+
+    for (n = 0; n < 16 && ADCON0bits.ADON && ADCON0bits.GO_DONE; n++) {
+        ADRESH = 1023 >> 8;
+        ADRESL = 1023 & 0xff;
+        ADCON0bits.GO_DONE = 0;
+        ADIF = 1;
+        sim_isr ();
+    }
+}
+
+/* Timer2 period including the postscaler, in instr cycles.
+ */
+static unsigned long
+t2_period (void)
+{
+    static const unsigned char prescale[4] = { 1, 4, 16, 16 };
+
+    return ((unsigned long)PR2 + 1) * prescale[T2CONbits.T2CKPS]
+                                    * (T2CONbits.TOUTPS + 1);
+}
+
+static void
+timers_run (void)
+{
+    unsigned long long end = now + CYCLES_PER_MS;
+
+    if (T1CONbits.TMR1ON && !t1_start)
+        t1_start = now ? now : 1;
+    if (!TMR2ON) {
+        t2_next = 0;
+        now = end;
+        return;
+    }
+    if (!t2_next)
+        t2_next = now + t2_period ();
+    while (t2_next <= end) {
+        now = t2_next;
+        if (T1CONbits.TMR1ON) {
+            unsigned long t1 = (unsigned long)(now - t1_start) + ISR_ENTRY;
+
+            TMR1L = t1 & 0xff;
+            TMR1H = (t1 >> 8) & 0xff;
+        }
+        TMR2IF = 1;
+        sim_isr ();
+        adc_run ();
+        t2_next += t2_period ();
+    }
+    now = end;
+}
+
+/* I2C master (see AN734b and i2c_getstate ()).
+ */
+static void
+ssp_event (void)
+{
+    SSPIF = 1;
+    if (SSPIE)
+        sim_isr ();
+}
+
+static void
+i2c_start (unsigned char addr, int rw)
+{
+    SSPSTATbits.S = 1;
+    SSPSTATbits.P = 0;
+    SSPSTATbits.D_A = 0;
+    SSPSTATbits.R_W = rw;
+    SSPSTATbits.BF = 1;
+    SSPCON1bits.CKP = rw ? 0 : 1;       /* slave holds SCL for reads */
+    SSPBUF = (addr << 1) | rw;
+    ssp_event ();
+}
+
+static void
+i2c_send (unsigned char c)
+{
+    SSPSTATbits.D_A = 1;
+    SSPSTATbits.R_W = 0;
+    SSPSTATbits.BF = 1;
+    SSPBUF = c;
+    ssp_event ();
+}
+
+static unsigned char
+i2c_recv (int last)
+{
+    unsigned char c = SSPBUF;           /* loaded by the previous event */
+
+    SSPSTATbits.D_A = 1;
+    SSPSTATbits.R_W = 1;
+    SSPSTATbits.BF = 0;
+    SSPCON1bits.CKP = last ? 1 : 0;     /* NACK after the last byte */
+    ssp_event ();
+    return c;
+}
+
+static void
+i2c_stop (void)
+{
+    SSPSTATbits.S = 0;
+    SSPSTATbits.P = 1;
+}
+
+static int
+i2c_run (xfer_t *x)
+{
+    int i;
+
+    if (!SSPCON1bits.SSPEN || x->addr != (SSPADD >> 1))
+        return -1;                      /* no ACK */
+    if (x->wlen > 0) {
+        i2c_start (x->addr, 0);
+        for (i = 0; i < x->wlen; i++)
+            i2c_send (x->wbuf[i]);
+    }
+    if (x->rlen > 0) {
+        i2c_start (x->addr, 1);         /* repeated start */
+        for (i = 0; i < x->rlen; i++)
+            x->rbuf[i] = i2c_recv (i == x->rlen - 1);
+    }
+    i2c_stop ();
+    return 0;
+}
+
+static void
+sim_ms (void)
+{
+    xfer_t *x;
+
+    pthread_mutex_lock (&lock);
+    while (!realtime && !pending)
+        pthread_cond_wait (&cond, &lock);
+    x = pending;
+    pthread_mutex_unlock (&lock);
+    if (x) {
+        x->result = i2c_run (x);
+        pthread_mutex_lock (&lock);
+        x->done = 1;
+        pending = NULL;
+        pthread_cond_broadcast (&cond);
+        pthread_mutex_unlock (&lock);
+    }
+    timers_run ();
+    if (realtime) {
+        next_ms.tv_nsec += 1000000;
+        if (next_ms.tv_nsec >= 1000000000) {
+            next_ms.tv_nsec -= 1000000000;
+            next_ms.tv_sec++;
+        }
+        clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next_ms, NULL);
+    }
+}
+
+void
+sim_delay_ms (unsigned int ms)
+{
+    while (ms-- > 0)
+        sim_ms ();
+}
+
+void
+sim_sleep (void)
+{
+    sim_ms ();
+}
+
+static void *
+firmware_thread (void *arg)
+{
+    firmware_main ();
+    return NULL;
+}
+
+int
+SIMPIC_FN(SIMPIC_NAME,simpic_start) (int rt)
+{
+    if (started)
+        return 0;
+    realtime = rt;
+    memset (eeprom, 0xff, sizeof (eeprom));
+    PORTA = PORTB = PORTC = 0xff;       /* inputs idle high */
+    memset ((void *)&PORTAbits, 0xff, sizeof (PORTAbits));
+    memset ((void *)&PORTBbits, 0xff, sizeof (PORTBbits));
+    memset ((void *)&PORTCbits, 0xff, sizeof (PORTCbits));
+    clock_gettime (CLOCK_MONOTONIC, &next_ms);
+    if (pthread_create (&thread, NULL, firmware_thread, NULL) != 0)
+        return -1;
+    pthread_detach (thread);
+    started = 1;
+    return 0;
+}
+
+int
+SIMPIC_FN(SIMPIC_NAME,simpic_xfer) (unsigned char addr,
+                                    const unsigned char *wbuf, int wlen,
+                                    unsigned char *rbuf, int rlen)
+{
+    xfer_t x = { addr, wbuf, wlen, rbuf, rlen, -1, 0 };
+
+    if (!started)
+        return -1;
+    pthread_mutex_lock (&lock);
+    while (pending)
+        pthread_cond_wait (&cond, &lock);
+    pending = &x;
+    pthread_cond_broadcast (&cond);
+    while (!x.done)
+        pthread_cond_wait (&cond, &lock);
+    pthread_mutex_unlock (&lock);
+    return x.result;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
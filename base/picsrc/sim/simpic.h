@@ -0,0 +1,32 @@
+/* simpic.h - run firmware built against sim/htc.h inside a host process */
+
+/* simpic.c is linked with one firmware image into a relocatable object,
+ * and every symbol but the SIMPIC_NAME ones is made local, so several
+ * firmware images can share a process (see hotspot/src/Makefile).
+ * SIMPIC_NAME is the image name, e.g. base_simpic_xfer ().
+ */
+
+#ifndef _SIM_SIMPIC_H
+#define _SIM_SIMPIC_H
+
+#define SIMPIC_CAT(a,b)         a##_##b
+#define SIMPIC_FN(name,fn)      SIMPIC_CAT(name,fn)
+
+#define SIMPIC_DECLARE(name) \
+    int SIMPIC_FN(name,simpic_start) (int realtime); \
+    int SIMPIC_FN(name,simpic_xfer) (unsigned char addr, \
+                                     const unsigned char *wbuf, int wlen, \
+                                     unsigned char *rbuf, int rlen);
+
+/* simpic_start () starts the firmware thread.  If realtime is zero,
+ * simulated time only runs while transfers wait for it.
+ * simpic_xfer () performs an I2C write of wlen bytes (if any), then a
+ * read of rlen bytes (if any) after a repeated start, at the next
+ * simulated millisecond.  Returns -1 if addr is not the firmware's.
+ */
+
+#endif /* _SIM_SIMPIC_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,180 @@
+/*****************************************************************************\
+ *  Copyright (C) 2012 Jim Garlick
+ *
+ *  This file is part of ultima8drivecorrector, replacement base electronics
+ *  for the Celestron Ultima 8 telescope.  For details, see
+ *  <http://code.google.com/p/ultima8drivecorrector>.
+ *
+ *  ultima8drivecorrector is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ultima8drivecorrector is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ *  Public License *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ultima8drivecorrector; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* encbench.c - find the maximum encoder edge rate hotspot.c can count */
+
+/* Runs the firmware image in gpsim with quadrature waveforms on RA0-RA3
+ * (RA forward, DEC reverse, edges interleaved) and a stream of "::Q"
+ * commands on the UART RX pin.  The LCD busy flag (DB7 on RC3) is pulled
+ * low, so lcd_wait_busy () sees the display ready.  At checkpoints the low
+ * bytes of enc_ra and enc_dec (_enc_ra and _enc_dec to HI-TECH C) are
+ * compared with the number of edges sent, and enc_illegal must still read
+ * zero.  The edge rate is raised until either check fails.  With -b, exit
+ * nonzero if the rate found is below the given baseline.
+ *
+ * cc -o encbench encbench.c gpbench.c
+ * ./encbench [-r start-rate] [-m max-rate] [-t seconds] [-q query-hz]
+ *            [-b baseline] cof
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "gpbench.h"
+
+#define SERIAL_BAUD     115200.0
+#define SETTLE_TIME     0.05        /* seconds for lcd_init () etc */
+
+#define PIN_RX          "portb5"
+#define PIN_LCD_BUSY    "portc3"
+
+/* RA forward, DEC reverse (see enc_tic_update) */
+static const gpb_enc_t enc[] = {
+    { "porta0", "porta1", "_enc_ra", 1 },
+    { "porta2", "porta3", "_enc_dec", -1 },
+};
+
+static double query_hz = 50;
+
+/* Serial "::Q" queries and the LCD busy flag.
+ */
+static void
+extra_stimulus (FILE *f, double start, double sec)
+{
+    const char *cmd = "::Q\n";
+    unsigned long maxq = (unsigned long)(query_hz * sec) + 1;
+    size_t cmdlen = strlen (cmd);
+    unsigned long *rt;
+    int *rv;
+    unsigned long rn = 0;
+    size_t k;
+    int bit;
+    double q, bt;
+
+    /* 8N1 async serial, idle high */
+    rt = malloc (sizeof (unsigned long) * maxq * cmdlen * 10);
+    rv = malloc (sizeof (int) * maxq * cmdlen * 10);
+    if (!rt || !rv) {
+        fprintf (stderr, "out of memory\n");
+        exit (1);
+    }
+    bt = GPB_INSTR_FREQ / SERIAL_BAUD;
+    for (q = start; q < start + sec * GPB_INSTR_FREQ
+                    && rn / 10 < maxq * cmdlen;
+                    q += GPB_INSTR_FREQ / query_hz) {
+        double c = q;
+
+        for (k = 0; k < cmdlen; k++) {
+            for (bit = 0; bit < 10; bit++) {
+                int level = bit == 0 ? 0
+                          : bit == 9 ? 1 : (cmd[k] >> (bit - 1)) & 1;
+
+                rt[rn] = (unsigned long)c;
+                rv[rn++] = level;
+                c += bt;
+            }
+        }
+    }
+    gpb_stimulus (f, "rx", PIN_RX, 1, rt, rv, (int)rn);
+    free (rt);
+    free (rv);
+
+    /* LCD DB7 reads 0 (not busy) whenever the PIC is not driving it */
+    fprintf (f, "module library libgpsim_modules\n");
+    fprintf (f, "module load pulldown lcd_busy\n");
+    fprintf (f, "node n_lcd_busy\n");
+    fprintf (f, "attach n_lcd_busy %s lcd_busy.pin\n", PIN_LCD_BUSY);
+}
+
+static const gpb_bench_t bench = {
+    .name           = "encbench",
+    .enc            = enc,
+    .nenc           = 2,
+    .illegal_var    = "_enc_illegal",
+    .settle         = SETTLE_TIME,
+    .extra          = extra_stimulus,
+};
+
+void
+usage (void)
+{
+    fprintf (stderr,
+"Usage: encbench [-v] [-r start-rate] [-m max-rate] [-t sec] [-q query-hz]\n"
+"                [-b baseline] cof\n"
+    );
+    exit (1);
+}
+
+int
+main (int argc, char *argv[])
+{
+    double rate = 1000;         /* edges/s per axis */
+    double max_rate = 500000;
+    double sec = 0.2;
+    double baseline = 0;
+    double good;
+    int verbose = 0;
+    int c;
+
+    while ((c = getopt (argc, argv, "vr:m:t:q:b:")) != -1) {
+        switch (c) {
+            case 'v':
+                verbose = 1;
+                break;
+            case 'r':
+                rate = strtod (optarg, NULL);
+                break;
+            case 'm':
+                max_rate = strtod (optarg, NULL);
+                break;
+            case 't':
+                sec = strtod (optarg, NULL);
+                break;
+            case 'q':
+                query_hz = strtod (optarg, NULL);
+                break;
+            case 'b':
+                baseline = strtod (optarg, NULL);
+                break;
+            default:
+                usage ();
+        }
+    }
+    if (optind != argc - 1 || rate <= 0 || sec <= 0 || query_hz <= 0)
+        usage ();
+
+    good = gpb_search (&bench, argv[optind], rate, max_rate, sec, verbose);
+    printf ("max sustainable edge rate: %.0f edges/s per axis"
+            " (both axes, ::Q at %.0f Hz)\n", good, query_hz);
+    if (good < baseline) {
+        fprintf (stderr, "encbench: below baseline of %.0f edges/s\n",
+                 baseline);
+        exit (1);
+    }
+    exit (0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
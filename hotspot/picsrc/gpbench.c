@@ -0,0 +1,231 @@
+/*****************************************************************************\
+ *  Copyright (C) 2012 Jim Garlick
+ *
+ *  This file is part of ultima8drivecorrector, replacement base electronics
+ *  for the Celestron Ultima 8 telescope.  For details, see
+ *  <http://code.google.com/p/ultima8drivecorrector>.
+ *
+ *  ultima8drivecorrector is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ultima8drivecorrector is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ *  Public License *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ultima8drivecorrector; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* gpbench.c - gpsim encoder edge rate benchmark */
+
+/* Each rate is one gpsim run.  Encoder e's edge i is sent at
+ * start + (i + e/nenc) * period, so edges on different encoders are
+ * interleaved evenly.  At CHECKPOINTS points between edges the low byte of
+ * each counter is compared with the number of edges sent, and any illegal
+ * transition counter must still read zero.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "gpbench.h"
+
+#define CHECKPOINTS     8
+#define RATE_STEP       1.25
+#define MAX_ENC         4
+
+/* quadrature state sequences, phase A in bit 0: forward counts up */
+static const int fwd[] = { 0, 1, 3, 2 };
+static const int rev[] = { 0, 2, 3, 1 };
+
+void
+gpb_stimulus (FILE *f, const char *name, const char *pin, int initial,
+              unsigned long *t, int *v, int n)
+{
+    int i;
+
+    fprintf (f, "stimulus asynchronous_stimulus\n");
+    fprintf (f, "initial_state %d\n", initial);
+    fprintf (f, "start_cycle 0\n");
+    fprintf (f, "{");
+    for (i = 0; i < n; i++)
+        fprintf (f, "%s%lu,%d", i > 0 ? "," : "", t[i], v[i]);
+    fprintf (f, "}\n");
+    fprintf (f, "name %s\n", name);
+    fprintf (f, "end\n");
+    fprintf (f, "node n_%s\n", name);
+    fprintf (f, "attach n_%s %s %s\n", name, name, pin);
+}
+
+/* Write a gpsim script for one edge rate.  Returns the number of edges
+ * per encoder sent before each checkpoint in edges[].
+ */
+static void
+write_script (FILE *f, const gpb_bench_t *b, const char *cof, double rate,
+              double sec, long *edges)
+{
+    unsigned long nedge = (unsigned long)(rate * sec);
+    unsigned long *t[MAX_ENC * 2];
+    int *v[MAX_ENC * 2];
+    int n[MAX_ENC * 2] = { 0 };
+    unsigned long i;
+    int pin, e, k;
+    double start = b->settle * GPB_INSTR_FREQ;
+    double period = GPB_INSTR_FREQ / rate;
+
+    for (pin = 0; pin < b->nenc * 2; pin++) {
+        t[pin] = malloc (sizeof (unsigned long) * (nedge + 1));
+        v[pin] = malloc (sizeof (int) * (nedge + 1));
+        if (!t[pin] || !v[pin]) {
+            fprintf (stderr, "out of memory\n");
+            exit (1);
+        }
+    }
+    for (i = 1; i <= nedge; i++) {
+        for (e = 0; e < b->nenc; e++) {
+            const int *seq = b->enc[e].sign > 0 ? fwd : rev;
+            int old = seq[(i - 1) % 4], new = seq[i % 4];
+            int bit = ((old ^ new) & 1) ? 0 : 1;
+
+            pin = e * 2 + bit;
+            t[pin][n[pin]] = (unsigned long)(start
+                                + (i + (double)e / b->nenc) * period);
+            v[pin][n[pin]++] = (new >> bit) & 1;
+        }
+    }
+    for (pin = 0; pin < b->nenc * 2; pin++) {
+        char name[16];
+
+        snprintf (name, sizeof (name), "enc%d", pin);
+        gpb_stimulus (f, name, pin & 1 ? b->enc[pin / 2].pin_b
+                                       : b->enc[pin / 2].pin_a,
+                      0, t[pin], v[pin], n[pin]);
+        free (t[pin]);
+        free (v[pin]);
+    }
+    if (b->extra)
+        b->extra (f, start, sec);
+
+    fprintf (f, "load %s\n", cof);
+    for (k = 0; k < CHECKPOINTS; k++) {
+        /* half an interleave step after the last encoder's edge, so no
+         * edge is in flight */
+        edges[k] = (long)(nedge * (k + 1) / CHECKPOINTS);
+        fprintf (f, "break c %lu\n", (unsigned long)(start + (edges[k]
+                         + (b->nenc - 0.5) / b->nenc) * period));
+        fprintf (f, "run\n");
+        fprintf (f, "echo CHECK %d\n", k);
+        for (e = 0; e < b->nenc; e++)
+            fprintf (f, "x %s\n", b->enc[e].var);
+        if (b->illegal_var)
+            fprintf (f, "x %s\n", b->illegal_var);
+    }
+    fprintf (f, "quit\n");
+}
+
+/* Parse "... = 0xNN ..." from a gpsim x command.
+ */
+static int
+parse_reg (const char *line, int *val)
+{
+    const char *p = strstr (line, "= 0x");
+
+    if (!p)
+        return 0;
+    *val = strtol (p + 2, NULL, 16) & 0xff;
+    return 1;
+}
+
+/* Run one rate.  Returns 1 if counts matched at every checkpoint.
+ */
+static int
+run_rate (const gpb_bench_t *b, const char *cof, double rate, double sec,
+          int verbose)
+{
+    char path[] = "/tmp/gpbenchXXXXXX";
+    char cmdline[256];
+    char line[256];
+    long edges[CHECKPOINTS];
+    int k = -1, val, nchecked = 0, ok = 1, which = 0;
+    FILE *f;
+    int fd;
+
+    if ((fd = mkstemp (path)) < 0 || !(f = fdopen (fd, "w"))) {
+        perror (path);
+        exit (1);
+    }
+    write_script (f, b, cof, rate, sec, edges);
+    fclose (f);
+
+    snprintf (cmdline, sizeof (cmdline), "gpsim -i -c %s 2>&1", path);
+    if (!(f = popen (cmdline, "r"))) {
+        perror ("gpsim");
+        exit (1);
+    }
+    while (fgets (line, sizeof (line), f)) {
+        if (verbose)
+            fputs (line, stderr);
+        if (sscanf (line, "CHECK %d", &k) == 1) {
+            which = 0;
+            continue;
+        }
+        if (k < 0 || which > b->nenc || !parse_reg (line, &val))
+            continue;
+        if (which < b->nenc && strstr (line, b->enc[which].var)) {
+            if (val != ((b->enc[which].sign * edges[k]) & 0xff))
+                ok = 0;
+            which++;
+        } else if (which == b->nenc && b->illegal_var
+                                    && strstr (line, b->illegal_var)) {
+            if (val != 0)
+                ok = 0;
+            which++;
+        } else
+            continue;
+        if (which == b->nenc + (b->illegal_var ? 1 : 0)) {
+            nchecked++;
+            which = b->nenc + 1;        /* done with this checkpoint */
+        }
+    }
+    pclose (f);
+    unlink (path);
+    if (nchecked != CHECKPOINTS) {
+        fprintf (stderr, "%s: gpsim output not understood (%d/%d)\n",
+                 b->name, nchecked, CHECKPOINTS);
+        exit (1);
+    }
+    return ok;
+}
+
+double
+gpb_search (const gpb_bench_t *b, const char *cof, double rate,
+            double max_rate, double sec, int verbose)
+{
+    double good = 0;
+
+    if (b->nenc > MAX_ENC) {
+        fprintf (stderr, "%s: too many encoders\n", b->name);
+        exit (1);
+    }
+    printf ("/*\tedges/s\tresult */\n");
+    for (; rate <= max_rate; rate *= RATE_STEP) {
+        int ok = run_rate (b, cof, rate, sec, verbose);
+
+        printf ("\t%.0f\t%s\n", rate, ok ? "ok" : "DIVERGED");
+        fflush (stdout);
+        if (!ok)
+            break;
+        good = rate;
+    }
+    return good;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
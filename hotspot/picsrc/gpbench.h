@@ -0,0 +1,48 @@
+/* gpbench.h - gpsim encoder edge rate benchmark, shared by encbench.c
+ * and auxmod/picsrc/auxbench.c
+ */
+
+#ifndef _GPBENCH_H
+#define _GPBENCH_H
+
+#include <stdio.h>
+
+#define GPB_INSTR_FREQ  16000000.0  /* 64 MHz / 4 */
+
+/* A quadrature encoder input and the firmware variable counting it.
+ * var is the symbol as HI-TECH C emits it (leading underscore).
+ */
+typedef struct {
+    const char      *pin_a;         /* gpsim pin names */
+    const char      *pin_b;
+    const char      *var;
+    int             sign;           /* 1=count up, -1=count down */
+} gpb_enc_t;
+
+typedef struct {
+    const char      *name;          /* program name for messages */
+    const gpb_enc_t *enc;
+    int             nenc;
+    const char      *illegal_var;   /* must read 0 at checkpoints, or NULL */
+    double          settle;         /* seconds before the first edge */
+    /* extra stimulus (start in cycles, sec long), or NULL */
+    void            (*extra) (FILE *f, double start, double sec);
+} gpb_bench_t;
+
+/* Emit one asynchronous stimulus for a pin from a list of (cycle, state).
+ */
+void gpb_stimulus (FILE *f, const char *name, const char *pin, int initial,
+                   unsigned long *t, int *v, int n);
+
+/* Raise the edge rate (edges/s per encoder) from rate in 25% steps until
+ * the counts diverge or max_rate is passed, printing each result.
+ * Returns the last rate that counted correctly, or 0.
+ */
+double gpb_search (const gpb_bench_t *b, const char *cof, double rate,
+                   double max_rate, double sec, int verbose);
+
+#endif /* _GPBENCH_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -58,10 +58,14 @@ __CONFIG (4, LVP_OFF);
 
 #define islcd(c)        ((c) >= 0x20 && (c) <= 0x7d)
 
-#define TIMER_INTR_FREQ       10
-#define TIMER_PRESCALER_RATIO 256
+#define LCD_CMD_CLEAR   0x01
+#define LCD_CMD_GOTO    0x80
+#define LCD_CLEAR_TICS  20      /* clear takes 1.52ms, others 37us */
+
+#define TIMER_INTR_FREQ       10000
+#define TIMER_PRESCALER_RATIO 16
 #define TIMER_COUNT_FREQ      (_XTAL_FREQ / (4 * TIMER_PRESCALER_RATIO))
-#define TIMER_COUNT_100MS     (65026L - (TIMER_COUNT_FREQ/TIMER_INTR_FREQ))
+#define TIMER_COUNT_TICK      (65536L - (TIMER_COUNT_FREQ/TIMER_INTR_FREQ))
 
 #define ENC_RA_A        PORTAbits.RA0
 #define ENC_RA_B        PORTAbits.RA1
@@ -71,6 +75,17 @@ __CONFIG (4, LVP_OFF);
 #define ENC_RA_RES      2160  // convenient: 360*6 (1 tic = 10')
 #define ENC_DEC_RES     2160
 
+/* Edges are timestamped with Timer1 (Fosc/4, 1:8 prescale) extended
+ * to 32 bits in software.  Velocity is reported in counts/1000s and
+ * decays to zero if no edge is seen for ENC_STOP_TIME.  The timebase
+ * wraps after about 2147s, so task_enc () latches an axis as expired
+ * once ENC_STOP_TIME has passed, before the time since its last edge can
+ * wrap back into range.
+ */
+#define ENC_TIME_FREQ   (_XTAL_FREQ / (4 * 8))
+#define ENC_VEL_SCALE   (ENC_TIME_FREQ * 1000UL)
+#define ENC_STOP_TIME   (ENC_TIME_FREQ * 30UL)
+
 #define SERIAL_BAUD     115200
 
 #define CBUF_SIZE       80
@@ -80,6 +95,8 @@ __CONFIG (4, LVP_OFF);
 
 #define CBUF_FULL(c)    (CBUF_PLUSONE((c)->head) == (c)->tail)
 #define CBUF_EMPTY(c)   ((c)->head == (c)->tail)
+#define CBUF_COUNT(c)   ((c)->head >= (c)->tail ? (c)->head - (c)->tail \
+                                : CBUF_SIZE - (c)->tail + (c)->head)
 
 typedef struct {
     volatile unsigned char   buf[CBUF_SIZE];
@@ -90,18 +107,59 @@ typedef struct {
 static cbuf_t serial_in = { "", 0, 0 };
 static cbuf_t serial_out = { "", 0, 0 };
 
+/* Bytes queued for the LCD.  Runtime LCD commands (clear, goto) are never
+ * printable, so islcd() doubles as the RS bit when the queue is drained.
+ */
+static cbuf_t lcd_out = { "", 0, 0 };
+
 void enc_tic (void);
+void lcd_tic (void);
 void lcd_putline (int line, const char *s);
 
 static int enc_dec = 0;
 static int enc_ra = 0;
 
+typedef struct {
+    unsigned long   last;       /* time of last edge */
+    unsigned long   period;     /* time between last two edges (0=unknown) */
+    signed char     dir;        /* direction of last edge (+1/-1) */
+    char            expired;    /* no edge for ENC_STOP_TIME */
+} enc_edge_t;
+
+static enc_edge_t enc_ra_edge = { 0, 0, 0, 0 };
+static enc_edge_t enc_dec_edge = { 0, 0, 0, 0 };
+static volatile unsigned int enc_time_hi = 0;
+
+static volatile unsigned int timer_ticks = 0;
+
+/* Firmware health counters, reported by ::S and cleared by ::SR.
+ */
+typedef struct {
+    unsigned int    uart_oerr;      /* UART receive overruns */
+    unsigned int    uart_ferr;      /* UART framing errors */
+    unsigned int    rx_overflow;    /* bytes dropped from full serial_in */
+    unsigned char   rx_hwm;         /* serial_in high water mark */
+    unsigned char   tx_hwm;         /* serial_out high water mark */
+    unsigned long   loop_max;       /* longest main loop pass (enc_time) */
+} health_t;
+
+static health_t health = { 0, 0, 0, 0, 0, 0 };
+
+/* Encoder transitions skipping a state, also reported by ::S.  Kept out of
+ * health_t so encbench can examine it by name in gpsim.
+ */
+static volatile unsigned int enc_illegal = 0;
+
 void
 serial_recv (void)
 {
-    if (CBUF_FULL(&serial_in))
+    if (CBUF_FULL(&serial_in)) {
         CBUF_INC(serial_in.tail);
+        health.rx_overflow++;
+    }
     serial_in.buf[CBUF_INC(serial_in.head)] = RCREG;
+    if (CBUF_COUNT(&serial_in) > health.rx_hwm)
+        health.rx_hwm = CBUF_COUNT(&serial_in);
 }
 
 void
@@ -130,6 +188,8 @@ serial_putc (unsigned char c)
         ;
     PIE1bits.TXIE = 0;
     serial_out.buf[CBUF_INC(serial_out.head)] = c;
+    if (CBUF_COUNT(&serial_out) > health.tx_hwm)
+        health.tx_hwm = CBUF_COUNT(&serial_out);
     PIE1bits.TXIE = 1;
 }
 
@@ -198,10 +258,12 @@ serial_checkerr (void)
     if (RCSTAbits.OERR) { /* overrun */
         RCSTAbits.CREN = 0;
         RCSTAbits.CREN = 1;
+        health.uart_oerr++;
         errors++;
     }
     if (RCSTAbits.FERR) { /* framing error */
         unsigned char dummy = RCREG;
+        health.uart_ferr++;
         errors++;
     }
     return errors;
@@ -210,17 +272,30 @@ serial_checkerr (void)
 void
 timer_tic (void)
 {
-    /* nothing to do at the moment */
+    timer_ticks++;
+    lcd_tic ();
+}
+
+unsigned int
+timer_now (void)
+{
+    unsigned int now;
+
+    INTCONbits.TMR0IE = 0;
+    now = timer_ticks;
+    INTCONbits.TMR0IE = 1;
+
+    return now;
 }
 
 void
 timer_init (void)
 {
-    T0CONbits.T0PS = 7;         /* set prescaler to 1:256 */
+    T0CONbits.T0PS = 3;         /* set prescaler to 1:16 */
     PSA = 0;                    /* assign prescaler */
     T0CS = 0;                   /* use instr cycle clock (CLOCK_FREQ/4) */
     T08BIT = 0;                 /* 16 bit mode */
-    TMR0 = TIMER_COUNT_100MS;   /* load count */
+    TMR0 = TIMER_COUNT_TICK;    /* load count */
     TMR0ON = 1;                 /* start timer0 */
 }
 
@@ -234,13 +309,17 @@ isr (void)
     if (PIE1bits.TXIE && TXIF) {
         serial_xmit ();
     }
+    if (PIE1bits.TMR1IE && PIR1bits.TMR1IF) {
+        enc_time_hi++;
+        PIR1bits.TMR1IF = 0;
+    }
     if (INTCONbits.RABIE && INTCONbits.RABIF) {
         enc_tic ();
         INTCONbits.RABIF = 0;
     }
     if (INTCONbits.TMR0IE && INTCONbits.TMR0IF) {
         timer_tic ();
-        TMR0 = TIMER_COUNT_100MS;
+        TMR0 = TIMER_COUNT_TICK;
         TMR0IF = 0;
     }
 }
@@ -310,46 +389,99 @@ lcd_write (char rs, unsigned char c)
     lcd_write_nybble (c);
 }
 
+/* Called from the timer interrupt: clock one nybble from lcd_out to the
+ * display per tick.  The tick period exceeds the HD44780 execution time
+ * so the busy flag need not be polled; clear is given extra ticks.
+ */
 void
-lcd_clear (void)
+lcd_tic (void)
 {
-    lcd_write (0, 0x1);
+    static unsigned char c;
+    static unsigned char lownybble = 0;
+    static unsigned char wait = 0;
+
+    if (wait > 0) {
+        wait--;
+    } else if (lownybble) {
+        lcd_write_nybble (c);
+        if (c == LCD_CMD_CLEAR)
+            wait = LCD_CLEAR_TICS;
+        lownybble = 0;
+    } else if (!CBUF_EMPTY(&lcd_out)) {
+        c = lcd_out.buf[CBUF_INC(lcd_out.tail)];
+        LCD_RS = islcd (c) ? 1 : 0;
+        lcd_write_nybble (c >> 4);
+        lownybble = 1;
+    }
 }
 
+unsigned char
+lcd_space (void)
+{
+    unsigned char n;
+
+    INTCONbits.TMR0IE = 0;
+    n = CBUF_SIZE - 1 - CBUF_COUNT(&lcd_out);
+    INTCONbits.TMR0IE = 1;
+
+    return n;
+}
+
+/* Queue a byte for lcd_tic ().  Caller must check lcd_space ().
+ */
 void
-lcd_putc (unsigned char c)
+lcd_queue (unsigned char c)
 {
-    lcd_write (1, c);
+    INTCONbits.TMR0IE = 0;
+    lcd_out.buf[CBUF_INC(lcd_out.head)] = c;
+    INTCONbits.TMR0IE = 1;
 }
 
 void
-lcd_goto (unsigned char x)
+lcd_clear (void)
 {
-    lcd_write (0, 0x80 + x);
+    lcd_queue (LCD_CMD_CLEAR);
 }
 
 void
-lcd_puts (const char *s)
+lcd_putc (unsigned char c)
 {
-    while (*s != '\0')
-        lcd_putc (*s++);
+    if (islcd (c))
+        lcd_queue (c);
+}
+
+void
+lcd_goto (unsigned char x)
+{
+    lcd_queue (LCD_CMD_GOTO + x);
 }
 
 /* Overwrite the selected LCD line (0, 1, ...) with s.
+ * Only changed lines are queued.  If the queue cannot take the whole line,
+ * it is dropped and the next call with the same content will retry.
  */
 void
 lcd_putline (int line, const char *s)
 {
+    static unsigned char shadow[LCD_MAXROW][LCD_MAXCOL];
+    unsigned char tmp[LCD_MAXCOL];
     int i = 0;
+    int j;
 
     if (line >= 0 && line < LCD_MAXROW) {
-        lcd_goto (line * 0x40);
-        while (s[i] != '\0' && i < LCD_MAXCOL) {
-            if (islcd (s[i]))
-                lcd_putc (s[i++]);
+        for (j = 0; j < LCD_MAXCOL; j++) {
+            while (s[i] != '\0' && !islcd (s[i]))
+                i++;
+            tmp[j] = s[i] != '\0' ? s[i++] : ' ';
         }
-        while (i++ < LCD_MAXCOL)
-            lcd_putc (' ');
+        if (!memcmp (shadow[line], tmp, LCD_MAXCOL))
+            return;
+        if (lcd_space () < LCD_MAXCOL + 1)
+            return;
+        lcd_goto (line * 0x40);
+        for (j = 0; j < LCD_MAXCOL; j++)
+            lcd_putc (tmp[j]);
+        memcpy (shadow[line], tmp, LCD_MAXCOL);
     }
 }
 
@@ -374,18 +506,60 @@ lcd_init (void)
 
     lcd_write (0, 0x28);        /* set interface length */
     lcd_write (0, 0xc);         /* display on, cursor off, cursor no blink */
-    lcd_clear;                  /* clear screen */
+    lcd_write (0, LCD_CMD_CLEAR); /* clear screen */
     lcd_write (0, 0x6);         /* set entry mode */
+    lcd_wait_busy ();           /* lcd_tic () does not poll busy flag */
+}
+
+/* Return the 32-bit edge timer.  Call from isr or with GIE clear.
+ * An overflow not yet counted by isr is detected from TMR1IF.
+ */
+unsigned long
+enc_time (void)
+{
+    unsigned int lo = TMR1;
+    unsigned int hi = enc_time_hi;
+
+    if (PIR1bits.TMR1IF && lo < 0x8000)
+        hi++;
+    return ((unsigned long)hi << 16) | lo;
+}
+
+unsigned long
+enc_time_now (void)
+{
+    unsigned long t;
+
+    INTCONbits.GIE = 0;
+    t = enc_time ();
+    INTCONbits.GIE = 1;
+
+    return t;
 }
 
 void
-enc_tic_update (unsigned char old, unsigned char new, int *count)
+enc_tic_update (unsigned char old, unsigned char new, int *count,
+                enc_edge_t *edge, unsigned long t)
 {
+    signed char dir;
+
     if (old != new) {
+        if ((old ^ new) == 0x03) {  // both phases changed: missed an edge
+            enc_illegal++;          // direction unknown, so don't step
+            edge->period = 0;
+            edge->last = t;
+            edge->dir = 0;
+            return;
+        }
         if (((old >> 1) ^ new) & 0x01) // grey code trick to get direction
-            (*count)++;
+            dir = 1;
         else
-            (*count)--;
+            dir = -1;
+        *count += dir;
+        edge->period = (dir == edge->dir) ? t - edge->last : 0;
+        edge->last = t;
+        edge->dir = dir;
+        edge->expired = 0;
     }
 }
 
@@ -394,12 +568,31 @@ enc_tic (void)
 {
     static unsigned char old = 0;
     unsigned char new = PORTA;
+    unsigned long t = enc_time ();
 
-    enc_tic_update (old & 0x3, new & 0x3, &enc_ra);
-    enc_tic_update ((old >> 2) & 0x3, (new >> 2) & 0x3, &enc_dec);
+    enc_tic_update (old & 0x3, new & 0x3, &enc_ra, &enc_ra_edge, t);
+    enc_tic_update ((old >> 2) & 0x3, (new >> 2) & 0x3, &enc_dec,
+                    &enc_dec_edge, t);
     old = new;
 }
 
+/* Velocity in counts/1000s.  While no new edge arrives, the time since
+ * the last edge bounds the period, so a stopped axis decays toward zero.
+ */
+long
+enc_velocity (const enc_edge_t *edge, unsigned long now)
+{
+    unsigned long dt = edge->period;
+
+    if (dt == 0 || edge->expired)
+        return 0;
+    if (now - edge->last > dt)
+        dt = now - edge->last;
+    if (dt > ENC_STOP_TIME)
+        return 0;
+    return edge->dir * (long)(ENC_VEL_SCALE / dt);
+}
+
 void
 enc_init (void)
 {
@@ -419,15 +612,144 @@ enc_init (void)
     IOCAbits.IOCA3 = 1;
 
     INTCONbits.RABIF = 0;   /* clear IOC flag */
+
+    T1CON = 0;
+    T1CONbits.RD16 = 1;     /* 16 bit read/write */
+    T1CONbits.T1CKPS = 3;   /* set prescaler to 1:8 (see ENC_TIME_FREQ) */
+    T1CONbits.TMR1CS = 0;   /* use instr cycle clock (CLOCK_FREQ/4) */
+    TMR1 = 0;
+    PIR1bits.TMR1IF = 0;
+    PIE1bits.TMR1IE = 1;    /* count overflows in enc_time_hi */
+    T1CONbits.TMR1ON = 1;   /* start timer1 */
 }
 
 void
-main(void)
+task_serial (void)
 {
     static unsigned char line[17];
-    int i;
+    static char out[40];
+
+    if (serial_gets (line, sizeof (line))) {
+        if (!strncmp (line, "::Q", 3)) { // Tangent 13 char format
+            INTCONbits.RABIE = 0;
+            sprintf (line, "%+.5d\t%+.5d\n", enc_ra, enc_dec);
+            serial_puts (line);
+            INTCONbits.RABIE = 1;
+        } else if (!strncmp (line, "::V", 3)) { // counts and velocity
+            enc_edge_t ra, dec;
+            int ra_count, dec_count;
+            unsigned long now;
+
+            INTCONbits.GIE = 0;
+            ra = enc_ra_edge;
+            dec = enc_dec_edge;
+            ra_count = enc_ra;
+            dec_count = enc_dec;
+            now = enc_time ();
+            INTCONbits.GIE = 1;
+            sprintf (out, "%+.5d\t%+.5d\t%+ld\t%+ld", ra_count, dec_count,
+                     enc_velocity (&ra, now), enc_velocity (&dec, now));
+            serial_puts (out);
+        } else if (!strncmp (line, "::SR", 4)) { // reset health counters
+            INTCONbits.GIE = 0;
+            memset (&health, 0, sizeof (health));
+            enc_illegal = 0;
+            INTCONbits.GIE = 1;
+            serial_puts ("OK");
+        } else if (!strncmp (line, "::S", 3)) { // health counters
+            health_t h;
+            unsigned int illegal;
+
+            INTCONbits.GIE = 0;
+            h = health;
+            illegal = enc_illegal;
+            INTCONbits.GIE = 1;
+            sprintf (out, "%u\t%u\t%u\t%u\t%u\t%u\t%lu",
+                     h.uart_oerr, h.uart_ferr, h.rx_overflow, illegal,
+                     h.rx_hwm, h.tx_hwm,
+                     h.loop_max / (ENC_TIME_FREQ / 1000000UL));
+            serial_puts (out);
+        } else {
+            lcd_putline (0, line);
+        }
+    }
+}
+
+void
+task_enc (void)
+{
+    unsigned long now;
+
+    INTCONbits.GIE = 0;
+    now = enc_time ();
+    if (now - enc_ra_edge.last > ENC_STOP_TIME)
+        enc_ra_edge.expired = 1;
+    if (now - enc_dec_edge.last > ENC_STOP_TIME)
+        enc_dec_edge.expired = 1;
+    INTCONbits.GIE = 1;
+}
+
+void
+task_lcd (void)
+{
+    static unsigned char line[17];
+
+    INTCONbits.RABIE = 0;
+    sprintf (line, "X=%+.4d Y=%+.4d", enc_ra, enc_dec);
+    INTCONbits.RABIE = 1;
+    lcd_putline (1, line);
+}
+
+/* Cooperative scheduler.  Tasks are listed in priority order with their
+ * period in timer ticks.  Each pass runs the highest priority task that is
+ * due, so a long task delays others by at most its own run time.
+ * There is no button task because no pushbuttons are wired to this PIC
+ * (see schem/), and no telemetry task because the router polls (::Q, ::V,
+ * ::S) and unsolicited output would corrupt its replies.
+ */
+typedef struct {
+    void            (*fun)(void);
+    unsigned int    period;
+    unsigned int    last;
+} task_t;
+
+static task_t tasks[] = {
+    { task_serial,  1,                      0 },
+    { task_lcd,     TIMER_INTR_FREQ / 10,   0 },
+    { task_enc,     TIMER_INTR_FREQ,        0 },
+};
+#define NTASKS          (sizeof (tasks) / sizeof (tasks[0]))
 
+void
+sched_run (void)
+{
+    unsigned int now;
+    unsigned long t;
+    unsigned char i;
+
+    for (;;) {
+        t = enc_time_now ();
+        now = timer_now ();
+        for (i = 0; i < NTASKS; i++) {
+            if (now - tasks[i].last >= tasks[i].period) {
+                tasks[i].last = now;
+                tasks[i].fun ();
+                break;
+            }
+        }
+        t = enc_time_now () - t;    /* whole pass, interrupts included */
+        if (t > health.loop_max)
+            health.loop_max = t;
+        if (i == NTASKS)
+            SLEEP ();           /* idle until the next interrupt */
+    }
+}
+
+void
+main(void)
+{
     OSCCONbits.IRCF = 7;        /* system clock HFOSC 16 MHz (x 4 with PLL) */
+    OSCCONbits.IDLEN = 1;       /* SLEEP enters idle mode (peripherals run) */
 
     ANSEL = 0;                  /* disable all ADC inputs */
     ANSELH = 0;
@@ -443,32 +765,15 @@ main(void)
     lcd_init ();
     serial_init ();
     enc_init ();
-    //timer_init ();
+    timer_init ();
     
     INTCONbits.PEIE = 1;        /* enable peripheral interrupts */
     INTCONbits.GIE = 1;         /* enable global interrupts */
     PIE1bits.RCIE = 1;          /* enable USART receive interrupts */
     INTCONbits.RABIE = 1;       /* enable interrupt on change interrupts */
-    //INTCONbits.TMR0IE = 1;      /* enable timer0 interrupt */
+    INTCONbits.TMR0IE = 1;      /* enable timer0 interrupt */
 
-    for (;;) {
-        if (serial_gets (line, sizeof (line))) {
-            if (!strncmp (line, "::Q", 3)) { // Tangent 13 char format
-                INTCONbits.RABIE = 0;
-                sprintf (line, "%+.5d\t%+.5d\n", enc_ra, enc_dec);
-                serial_puts (line);
-                INTCONbits.RABIE = 1;
-            } else {
-                lcd_putline (0, line);
-            }
-        }
-
-        INTCONbits.RABIE = 0;
-        sprintf (line, "X=%+.4d Y=%+.4d", enc_ra, enc_dec);
-        INTCONbits.RABIE = 1;
-        lcd_putline (1, line);
-        __delay_ms (10);
-    }
+    sched_run ();
 }
 
 /*
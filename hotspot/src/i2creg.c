@@ -0,0 +1,333 @@
+/*****************************************************************************\
+ *  Copyright (C) 2012 Jim Garlick
+ *
+ *  This file is part of ultima8drivecorrector, replacement base electronics
+ *  for the Celestron Ultima 8 telescope.  For details, see
+ *  <http://code.google.com/p/ultima8drivecorrector>.
+ *
+ *  ultima8drivecorrector is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ultima8drivecorrector is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ *  Public License *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ultima8drivecorrector; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* i2creg.c - master side of the base and aux I2C register protocol */
+
+/* See base/README.md for the protocol.  A read is one combined transfer:
+ * WRITE 1 regnum, repeated start, READ 2n bytes.  A write is
+ * WRITE 2 regnum lsb msb ...  Both use the firmware's burst support.
+ * The i2c-dev and simulated backends move bytes; the regd backend passes
+ * whole register operations to regd (see regd.c for its protocol).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "i2creg.h"
+
+#define CMD_READ        1       /* as i2c_slave.h */
+#define CMD_WRITE       2
+
+typedef struct {
+    /* byte transfer: write wlen bytes, then read rlen after a restart */
+    int (*xfer) (i2creg_t *bus, int addr, const uint8_t *w, int wlen,
+                 uint8_t *r, int rlen);
+    /* register operations, if the backend does not move bytes */
+    int (*read) (i2creg_t *bus, int addr, int reg, uint16_t *val, int n);
+    int (*write) (i2creg_t *bus, int addr, int reg, const uint16_t *val,
+                  int n);
+    void (*close) (i2creg_t *bus);
+} i2creg_ops_t;
+
+struct i2creg {
+    const i2creg_ops_t  *ops;
+    int                 fd;
+    char                line[1024];     /* regd: response buffer */
+    int                 nline;
+};
+
+/* i2c-dev backend
+ */
+static int
+dev_xfer (i2creg_t *bus, int addr, const uint8_t *w, int wlen,
+          uint8_t *r, int rlen)
+{
+    struct i2c_msg msg[2];
+    struct i2c_rdwr_ioctl_data data = { msg, 0 };
+
+    if (wlen > 0) {
+        msg[data.nmsgs].addr = addr;
+        msg[data.nmsgs].flags = 0;
+        msg[data.nmsgs].len = wlen;
+        msg[data.nmsgs].buf = (uint8_t *)w;
+        data.nmsgs++;
+    }
+    if (rlen > 0) {
+        msg[data.nmsgs].addr = addr;
+        msg[data.nmsgs].flags = I2C_M_RD;
+        msg[data.nmsgs].len = rlen;
+        msg[data.nmsgs].buf = r;
+        data.nmsgs++;
+    }
+    if (ioctl (bus->fd, I2C_RDWR, &data) < 0)
+        return -1;
+    return 0;
+}
+
+static void
+fd_close (i2creg_t *bus)
+{
+    close (bus->fd);
+}
+
+static const i2creg_ops_t dev_ops = { dev_xfer, NULL, NULL, fd_close };
+
+/* simulated backend (simbus.c)
+ */
+#ifdef HAVE_SIMBUS
+int simbus_start (int realtime);
+int simbus_xfer (int addr, const uint8_t *w, int wlen, uint8_t *r, int rlen);
+
+static int
+sim_xfer (i2creg_t *bus, int addr, const uint8_t *w, int wlen,
+          uint8_t *r, int rlen)
+{
+    if (simbus_xfer (addr, w, wlen, r, rlen) < 0) {
+        errno = ENXIO;
+        return -1;
+    }
+    return 0;
+}
+
+static const i2creg_ops_t sim_ops = { sim_xfer, NULL, NULL, NULL };
+#endif
+
+/* regd backend: one line per request and per response.
+ */
+static int
+regd_request (i2creg_t *bus, const char *req, char **resp)
+{
+    int len = strlen (req), n;
+    char *nl;
+
+    while (len > 0) {
+        if ((n = write (bus->fd, req, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        req += n;
+        len -= n;
+    }
+    bus->nline = 0;
+    while (!(nl = memchr (bus->line, '\n', bus->nline))) {
+        if (bus->nline == sizeof (bus->line) - 1) {
+            errno = EPROTO;
+            return -1;
+        }
+        n = read (bus->fd, bus->line + bus->nline,
+                  sizeof (bus->line) - 1 - bus->nline);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0)
+                errno = ECONNRESET;
+            return -1;
+        }
+        bus->nline += n;
+    }
+    *nl = '\0';
+    if (!strncmp (bus->line, "err ", 4)) {
+        errno = strtol (bus->line + 4, NULL, 10);
+        return -1;
+    }
+    if (strncmp (bus->line, "ok", 2)) {
+        errno = EPROTO;
+        return -1;
+    }
+    *resp = bus->line + 2;
+    return 0;
+}
+
+static int
+regd_read (i2creg_t *bus, int addr, int reg, uint16_t *val, int n)
+{
+    char req[64], *resp, *end;
+    int i;
+
+    snprintf (req, sizeof (req), "r %d %d %d\n", addr, reg, n);
+    if (regd_request (bus, req, &resp) < 0)
+        return -1;
+    for (i = 0; i < n; i++) {
+        val[i] = strtoul (resp, &end, 0);
+        if (end == resp) {
+            errno = EPROTO;
+            return -1;
+        }
+        resp = end;
+    }
+    return 0;
+}
+
+static int
+regd_write (i2creg_t *bus, int addr, int reg, const uint16_t *val, int n)
+{
+    char req[32 + I2CREG_MAX_BURST * 7], *resp;
+    int i, len;
+
+    len = snprintf (req, sizeof (req), "w %d %d", addr, reg);
+    for (i = 0; i < n; i++)
+        len += snprintf (req + len, sizeof (req) - len, " %u", val[i]);
+    snprintf (req + len, sizeof (req) - len, "\n");
+    return regd_request (bus, req, &resp);
+}
+
+static const i2creg_ops_t regd_ops = { NULL, regd_read, regd_write, fd_close };
+
+static int
+regd_connect (const char *path)
+{
+    struct sockaddr_un sun;
+    int fd;
+
+    if (strlen (path) >= sizeof (sun.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    memset (&sun, 0, sizeof (sun));
+    sun.sun_family = AF_UNIX;
+    strcpy (sun.sun_path, path);
+    if (connect (fd, (struct sockaddr *)&sun, sizeof (sun)) < 0) {
+        int saved = errno;
+
+        close (fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+i2creg_t *
+i2creg_open (const char *spec)
+{
+    i2creg_t *bus = calloc (1, sizeof (*bus));
+
+    if (!bus)
+        return NULL;
+    bus->fd = -1;
+    if (!strncmp (spec, "regd", 4) && (spec[4] == '\0' || spec[4] == ':')) {
+        bus->ops = &regd_ops;
+        bus->fd = regd_connect (spec[4] ? spec + 5 : I2CREG_REGD_SOCK);
+    } else if (!strcmp (spec, "sim") || !strcmp (spec, "sim-fast")) {
+#ifdef HAVE_SIMBUS
+        bus->ops = &sim_ops;
+        bus->fd = simbus_start (!strcmp (spec, "sim"));
+#else
+        errno = ENOSYS;
+#endif
+    } else {
+        bus->ops = &dev_ops;
+        bus->fd = open (spec, O_RDWR);
+    }
+    if (bus->fd < 0) {
+        int saved = errno;
+
+        free (bus);
+        errno = saved;
+        return NULL;
+    }
+    return bus;
+}
+
+void
+i2creg_close (i2creg_t *bus)
+{
+    if (bus->ops->close)
+        bus->ops->close (bus);
+    free (bus);
+}
+
+static int
+check_args (int addr, int reg, int n)
+{
+    if (addr < 0 || addr > 0x7f || reg < 0 || reg > 0xff || n < 1
+                                 || n > I2CREG_MAX_BURST) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int
+i2creg_read (i2creg_t *bus, int addr, int reg, uint16_t *val, int n)
+{
+    uint8_t w[2] = { CMD_READ, reg };
+    uint8_t r[2 * I2CREG_MAX_BURST];
+    int i;
+
+    if (check_args (addr, reg, n) < 0)
+        return -1;
+    if (bus->ops->read)
+        return bus->ops->read (bus, addr, reg, val, n);
+    if (bus->ops->xfer (bus, addr, w, sizeof (w), r, 2 * n) < 0)
+        return -1;
+    for (i = 0; i < n; i++)
+        val[i] = r[2 * i] | (uint16_t)r[2 * i + 1] << 8;
+    return 0;
+}
+
+int
+i2creg_write (i2creg_t *bus, int addr, int reg, const uint16_t *val, int n)
+{
+    uint8_t w[2 + 2 * I2CREG_MAX_BURST] = { CMD_WRITE, reg };
+    int i;
+
+    if (check_args (addr, reg, n) < 0)
+        return -1;
+    if (bus->ops->write)
+        return bus->ops->write (bus, addr, reg, val, n);
+    for (i = 0; i < n; i++) {
+        w[2 + 2 * i] = val[i] & 0xff;
+        w[3 + 2 * i] = val[i] >> 8;
+    }
+    return bus->ops->xfer (bus, addr, w, 2 + 2 * n, NULL, 0);
+}
+
+int
+i2creg_stats (i2creg_t *bus, char *buf, int len)
+{
+    char *resp;
+
+    if (bus->ops != &regd_ops) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (regd_request (bus, "s\n", &resp) < 0)
+        return -1;
+    snprintf (buf, len, "%s", resp[0] == ' ' ? resp + 1 : resp);
+    return 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,40 @@
+/* i2creg.h - master side of the base and aux I2C register protocol */
+
+#ifndef _I2CREG_H
+#define _I2CREG_H
+
+#include <stdint.h>
+
+#define I2CREG_BASE_ADDR    8
+#define I2CREG_AUX_ADDR     9
+#define I2CREG_MAX_BURST    32          /* registers per transfer */
+#define I2CREG_REGD_SOCK    "/tmp/regd.sock"
+
+typedef struct i2creg i2creg_t;
+
+/* Open a bus.  spec is one of:
+ *   /dev/i2c-N     Linux i2c-dev adapter
+ *   sim            base and aux firmware simulated in-process, real time
+ *   sim-fast       same, but simulated time only runs for transfers
+ *   regd[:path]    client of regd, which owns the bus
+ * Returns NULL with errno set on failure.
+ */
+i2creg_t *i2creg_open (const char *spec);
+void i2creg_close (i2creg_t *bus);
+
+/* Burst read or write n 16-bit registers starting at reg.
+ * Returns 0, or -1 with errno set.
+ */
+int i2creg_read (i2creg_t *bus, int addr, int reg, uint16_t *val, int n);
+int i2creg_write (i2creg_t *bus, int addr, int reg, const uint16_t *val,
+                  int n);
+
+/* regd statistics as text (regd backend only).
+ */
+int i2creg_stats (i2creg_t *bus, char *buf, int len);
+
+#endif /* _I2CREG_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -22,14 +22,10 @@
 
 /* netscope.c - accept commands for Sky Safari and SkyMap iPhone apps */
 
-/* cc -o netscope netscope.c
+/* cc -o netscope netscope.c i2creg.c
  * ./netscope -d to test without PIC 
  */
 
-/* FIXME: properly handle commands that are not aligned on recv () message
- * boundaries.
- */
-
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -44,6 +40,13 @@
 #include <arpa/inet.h>
 #include <termios.h>
 #include <getopt.h>
+#include <time.h>
+#include <poll.h>
+#ifdef HAVE_TIMERFD
+#include <sys/timerfd.h>
+#endif
+
+#include "i2creg.h"
 
 typedef enum { MODE_ENC, MODE_LX200 } emumode_t;
 
@@ -187,27 +190,751 @@ void enc_srv (int fd, int sfd)
     }
 }
 
+/* Base control over I2C (see base/README.md and i2creg.h).  LX200 DEC
+ * slews become virtual handbox buttons (ibuttons), so the base applies
+ * them on its next main loop pass just as it would the real handbox, and
+ * the LX200 rate selects the DEC motor speed.  RA slews set the custom
+ * tracking rate to sidereal plus or minus the LX200 rate's offset, up to
+ * the handbox rates (0.5x and 1.5x sidereal), and a halt restores the
+ * selected tracking rate.  Each command costs at most one register write
+ * (plus one to cancel a guide pulse on the same axis), and the time from
+ * receiving it to the write completing is measured against a register
+ * write round trip, overall and for each move and halt command.
+ */
+#define BASE_REG_BUTTONS    0
+#define BASE_REG_DC_SPEED   14
+#define BASE_REG_TRACK_RATE 35          /* track-custom follows */
+#define BUTTON_NORTH        0x01
+#define BUTTON_SOUTH        0x02
+#define BUTTON_EAST         0x04
+#define BUTTON_WEST         0x08
+
+typedef enum { RATE_GUIDE=0, RATE_CENTER=1, RATE_FIND=2, RATE_SLEW=3 } rate_t;
+
+static const uint16_t rate_dc_speed[] = { 1, 1, 0, 0 };  /* 0=fast 1=slow */
+static const double rate_ra_offset[] = { 0.1, 0.25, 0.5, 0.5 }; /* x sid */
+
+/* Tracking rates are in Hz of the LX200 model, where 60.0 is sidereal.
+ * Custom rates are sent as track-custom (0x8000 = sidereal) and limited
+ * to the handbox rates, 0.5x to 1.5x.
+ */
+typedef enum {
+    TRACK_SIDEREAL=0, TRACK_LUNAR=1, TRACK_SOLAR=2, TRACK_CUSTOM=3,
+} track_t;
+#define TRACK_SIDEREAL_HZ   60.0
+#define TRACK_MIN_HZ        (0.5 * TRACK_SIDEREAL_HZ)
+#define TRACK_MAX_HZ        (1.5 * TRACK_SIDEREAL_HZ)
+
+static const double track_hz[] = { TRACK_SIDEREAL_HZ, 58.696, 59.836 };
+
+static i2creg_t *base = NULL;
+static uint16_t ibuttons = 0;           /* as last written */
+static rate_t rate = RATE_SLEW;
+static track_t track = TRACK_SIDEREAL;
+static double track_custom_hz = TRACK_SIDEREAL_HZ;
+static uint16_t ra_move = 0;            /* BUTTON_EAST/WEST while slewing */
+
+typedef struct {
+    unsigned long   n;
+    unsigned long   over;               /* took longer than rtt */
+    double          min, max, sum;      /* us */
+    double          rtt;                /* register write round trip (us) */
+} latency_t;
+
+static latency_t base_lat = { 0, 0, 0, 0, 0, 0 };
+
+/* LX200 move and halt commands, each timed from receipt to the last
+ * register write it caused completing (press to ack).
+ */
+typedef enum {
+    MOVE_E=0, MOVE_W=1, MOVE_N=2, MOVE_S=3,
+    HALT=4, HALT_E=5, HALT_W=6, HALT_N=7, HALT_S=8,
+    MOVE_COUNT
+} move_t;
+
+static const char *move_cmd[] = {
+    ":Me#", ":Mw#", ":Mn#", ":Ms#", ":Q#", ":Qe#", ":Qw#", ":Qn#", ":Qs#",
+};
+static latency_t move_lat[MOVE_COUNT];
+
+static void
+latency_add (latency_t *l, double t)
+{
+    if (l->n == 0 || t < l->min)
+        l->min = t;
+    if (t > l->max)
+        l->max = t;
+    if (base_lat.rtt > 0 && t > base_lat.rtt)
+        l->over++;
+    l->sum += t;
+    l->n++;
+}
+
+static double
+now_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void
+base_open (const char *spec)
+{
+    uint16_t val;
+    double t;
+    int i;
+
+    if (!(base = i2creg_open (spec))) {
+        fprintf (stderr, "%s: %s (base control disabled)\n", spec,
+                 strerror (errno));
+        return;
+    }
+    /* Start from a known state: buttons released, fast slew, sidereal
+     * tracking (any fine offset is left alone).  The button
+     * writes, worst of several, are the one round trip budget.
+     */
+    val = rate_dc_speed[rate];
+    i2creg_write (base, I2CREG_BASE_ADDR, BASE_REG_DC_SPEED, &val, 1);
+    val = track;
+    i2creg_write (base, I2CREG_BASE_ADDR, BASE_REG_TRACK_RATE, &val, 1);
+    for (i = 0; i < 5; i++) {
+        val = ibuttons;
+        t = now_us ();
+        if (i2creg_write (base, I2CREG_BASE_ADDR, BASE_REG_BUTTONS, &val,
+                          1) < 0)
+            continue;
+        t = now_us () - t;
+        if (t > base_lat.rtt)
+            base_lat.rtt = t;
+    }
+}
+
+/* Write n base registers from reg for a command that arrived at t0.
+ * Returns the time the write completed, or -1 on failure.
+ */
+static double
+base_write_regs (int reg, const uint16_t *val, int n, double t0)
+{
+    double done, t;
+
+    if (!base)
+        return -1;
+    if (i2creg_write (base, I2CREG_BASE_ADDR, reg, val, n) < 0) {
+        if (debug)
+            perror ("base write");
+        return -1;
+    }
+    done = now_us ();
+    t = done - t0;
+    latency_add (&base_lat, t);
+    if (debug)
+        fprintf (stderr, "B: reg %d = 0x%x%s in %.0fus\n", reg, val[0],
+                 n > 1 ? " ..." : "", t);
+    return done;
+}
+
+static double
+base_write (int reg, uint16_t val, double t0)
+{
+    return base_write_regs (reg, &val, 1, t0);
+}
+
+/* Press the set buttons and release the clear ones.  t0 is when the
+ * command arrived.  Returns as base_write ().
+ */
+double
+base_buttons (uint16_t set, uint16_t clear, double t0)
+{
+    uint16_t b = (ibuttons & ~clear) | set;
+
+    if (b == ibuttons)
+        return base ? now_us () : -1;
+    ibuttons = b;
+    return base_write (BASE_REG_BUTTONS, b, t0);
+}
+
+/* Slew RA east or west at the selected rate, or stop (dir 0) and return
+ * to the selected tracking rate.  Returns as base_write ().
+ */
+double
+base_ra_move (uint16_t dir, double t0)
+{
+    uint16_t val[2];
+    double x = TRACK_SIDEREAL_HZ;
+
+    if (dir == ra_move)
+        return base ? now_us () : -1;
+    ra_move = dir;
+    if (dir == BUTTON_EAST)
+        x *= 1 - rate_ra_offset[rate];
+    else if (dir == BUTTON_WEST)
+        x *= 1 + rate_ra_offset[rate];
+    else
+        x = track_custom_hz;            /* as base_track () sends it */
+    val[0] = dir ? TRACK_CUSTOM : track;
+    val[1] = (uint16_t)(x / TRACK_SIDEREAL_HZ * 0x8000 + 0.5);
+    return base_write_regs (BASE_REG_TRACK_RATE, val, 2, t0);
+}
+
+void
+base_rate (rate_t r, double t0)
+{
+    if (r == rate)
+        return;
+    rate = r;
+    base_write (BASE_REG_DC_SPEED, rate_dc_speed[r], t0);
+    if (ra_move) {
+        uint16_t dir = ra_move;
+
+        ra_move = 0;                    /* rewrite at the new rate */
+        base_ra_move (dir, t0);
+    }
+}
+
+/* Select a tracking rate.  For TRACK_CUSTOM, hz is the rate.  During an
+ * RA slew it takes effect when the slew ends.
+ */
+void
+base_track (track_t tr, double hz, double t0)
+{
+    uint16_t val[2];
+
+    if (tr == TRACK_CUSTOM) {
+        if (hz < TRACK_MIN_HZ)
+            hz = TRACK_MIN_HZ;
+        if (hz > TRACK_MAX_HZ)
+            hz = TRACK_MAX_HZ;
+        track_custom_hz = hz;
+    }
+    track = tr;
+    if (ra_move)
+        return;
+    val[0] = tr;
+    val[1] = (uint16_t)(track_custom_hz / TRACK_SIDEREAL_HZ * 0x8000 + 0.5);
+    base_write_regs (BASE_REG_TRACK_RATE, val, 2, t0);
+}
+
+/* Record a move or halt command's latency, given the time its last write
+ * completed (or -1 if it failed).
+ */
+static void
+move_done (move_t m, double done, double t0)
+{
+    if (done >= 0)
+        latency_add (&move_lat[m], done - t0);
+}
+
+void
+base_latency_report (void)
+{
+    int i;
+
+    if (base_lat.n == 0)
+        return;
+    fprintf (stderr, "base commands: %lu, latency min/mean/max"
+             " %.0f/%.0f/%.0fus, %lu over %.0fus round trip\n",
+             base_lat.n, base_lat.min, base_lat.sum / base_lat.n,
+             base_lat.max, base_lat.over, base_lat.rtt);
+    for (i = 0; i < MOVE_COUNT; i++) {
+        latency_t *l = &move_lat[i];
+
+        if (l->n == 0)
+            continue;
+        fprintf (stderr, "  %-5s %lu, press to ack min/mean/max"
+                 " %.0f/%.0f/%.0fus, %lu over\n", move_cmd[i], l->n,
+                 l->min, l->sum / l->n, l->max, l->over);
+    }
+}
+
+/* LX200 pulse guiding (:Mg[nsew]DDDD#) writes the base's guide-ra or
+ * guide-dec register (ms, 0x8000=east or south).  The base times the
+ * pulse in its AC interrupt to within one 100us tick, and an RA pulse
+ * adds the east or west rate offset straight into the drive, so unlike
+ * an ibuttons press it is not stretched by the rate ramp.  Pulses leave
+ * ibuttons alone, so they cannot release a manual slew; a pulse on an
+ * axis held by a slew is ignored (the base does the same for DEC), and a
+ * slew cancels a pulse on its axis.  RA and DEC pulses are independent
+ * and may overlap.  A pulse outlives the connection that started it (the
+ * client may reconnect per command), since the base times it anyway.
+ *
+ * Each pulse's length is measured: it starts at the midpoint of the
+ * register write, and shortly before its expected end the register is
+ * read back.  The base holds the remaining ms rounded up, so the end is
+ * estimated at the midpoint of that read plus the remaining ms less half
+ * a ms, and the error against the requested length is kept.  netscope
+ * keeps the readback and end times on CLOCK_MONOTONIC and waits for them
+ * in lx200_wait () alongside the sockets, on a timerfd where the kernel
+ * has them (not the router's 2.4 kernel) and otherwise in the poll ()
+ * timeout.
+ */
+#define BASE_REG_GUIDE_RA   8
+#define BASE_REG_GUIDE_DEC  9
+#define GUIDE_REVERSE       0x8000
+#define PULSE_PROBE_US      2000.0      /* readback this long before end */
+
+typedef enum { AXIS_RA=0, AXIS_DEC=1 } axis_t;
+
+static const uint16_t axis_buttons[] = {
+    BUTTON_EAST | BUTTON_WEST, BUTTON_NORTH | BUTTON_SOUTH,
+};
+static const int axis_reg[] = { BASE_REG_GUIDE_RA, BASE_REG_GUIDE_DEC };
+
+typedef struct {
+    uint16_t        button;             /* direction, or 0 if idle */
+    int             ms;                 /* requested length */
+    double          probe;              /* readback time (us), 0=done */
+    double          end;                /* expected end (us) */
+} pulse_t;
+
+typedef struct {
+    unsigned long   n;                  /* lengths measured */
+    unsigned long   early;              /* over before the readback */
+    double          min, max, sum;      /* length error (us) */
+} pulse_stats_t;
+
+static pulse_t pulse[2];
+static pulse_stats_t pulse_stats = { 0, 0, 0, 0, 0 };
+static int pulse_tfd = -1;
+
+static void
+pulse_start (axis_t axis, uint16_t button, int ms, double t0)
+{
+    pulse_t *p = &pulse[axis];
+    uint16_t val = ms;
+    double start, t;
+
+    if ((ibuttons | ra_move) & axis_buttons[axis]) {
+        if (debug)
+            fprintf (stderr, "G: %s pulse ignored during slew\n",
+                     axis == AXIS_RA ? "ra" : "dec");
+        return;
+    }
+    if (button & (BUTTON_EAST | BUTTON_SOUTH))
+        val |= GUIDE_REVERSE;
+    start = now_us ();
+    if ((t = base_write (axis_reg[axis], val, t0)) < 0)
+        return;
+    start = (start + t) / 2;
+    p->button = ms > 0 ? button : 0;
+    p->ms = ms;
+    p->end = start + ms * 1e3;
+    p->probe = p->end - PULSE_PROBE_US - base_lat.rtt;
+    if (p->probe < start + ms * 1e3 / 2)
+        p->probe = start + ms * 1e3 / 2;
+}
+
+/* Read back the time the base has left on a pulse near its end, and
+ * record the length error.
+ */
+static void
+pulse_check (axis_t axis)
+{
+    pulse_t *p = &pulse[axis];
+    uint16_t val;
+    double t, err;
+
+    p->probe = 0;
+    t = now_us ();
+    if (!base || i2creg_read (base, I2CREG_BASE_ADDR, axis_reg[axis],
+                              &val, 1) < 0)
+        return;
+    t = (t + now_us ()) / 2;
+    val &= ~GUIDE_REVERSE;
+    if (val == 0) {
+        pulse_stats.early++;
+        if (debug)
+            fprintf (stderr, "G: %s %dms pulse over %.0fus before its end\n",
+                     axis == AXIS_RA ? "ra" : "dec", p->ms, p->end - t);
+        return;
+    }
+    err = t + (val - 0.5) * 1e3 - p->end;
+    if (pulse_stats.n == 0 || err < pulse_stats.min)
+        pulse_stats.min = err;
+    if (pulse_stats.n == 0 || err > pulse_stats.max)
+        pulse_stats.max = err;
+    pulse_stats.sum += err;
+    pulse_stats.n++;
+    if (debug)
+        fprintf (stderr, "G: %s %dms pulse, %ums left, error %+.0fus\n",
+                 axis == AXIS_RA ? "ra" : "dec", p->ms, val, err);
+}
+
+/* End any pulse running in one of the directions in clear (e.g. by :Q#
+ * or a slew on that axis).
+ */
+static void
+pulse_cancel (uint16_t clear, double t0)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (pulse[i].button & clear) {
+            pulse[i].button = 0;
+            base_write (axis_reg[i], 0, t0);
+        }
+    }
+}
+
+static void
+pulse_expire (void)
+{
+    double t = now_us ();
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (!pulse[i].button)
+            continue;
+        if (pulse[i].probe > 0 && pulse[i].probe <= t)
+            pulse_check (i);
+        if (pulse[i].end <= t)
+            pulse[i].button = 0;
+    }
+}
+
+/* Next readback or end (us), or 0 if no pulse is running.
+ */
+static double
+pulse_next (void)
+{
+    double next = 0, t;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (!pulse[i].button)
+            continue;
+        t = pulse[i].probe > 0 ? pulse[i].probe : pulse[i].end;
+        if (next == 0 || t < next)
+            next = t;
+    }
+    return next;
+}
+
+/* Arm the timer for the next deadline.  Returns the poll () timeout in ms.
+ */
+static int
+pulse_arm (void)
+{
+    double next = pulse_next ();
+#ifdef HAVE_TIMERFD
+    struct itimerspec its;
+
+    if (pulse_tfd >= 0) {
+        memset (&its, 0, sizeof (its));
+        its.it_value.tv_sec = (time_t)(next / 1e6);
+        its.it_value.tv_nsec = (long)((next - its.it_value.tv_sec * 1e6)
+                                      * 1e3);
+        if (next > 0 && its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+            its.it_value.tv_nsec = 1;   /* zero would disarm */
+        timerfd_settime (pulse_tfd, TFD_TIMER_ABSTIME, &its, NULL);
+        return -1;
+    }
+#endif
+    if (next == 0)
+        return -1;
+    next -= now_us ();
+    return next > 0 ? (int)((next + 999) / 1e3) : 0;
+}
+
+static void
+pulse_init (void)
+{
+#ifdef HAVE_TIMERFD
+    if (pulse_tfd < 0 && (pulse_tfd = timerfd_create (CLOCK_MONOTONIC,
+                                                      0)) < 0) {
+        if (debug)
+            perror ("timerfd_create");
+    }
+#endif
+}
+
+void
+pulse_report (void)
+{
+    if (pulse_stats.n + pulse_stats.early == 0)
+        return;
+    fprintf (stderr, "guide pulses: %lu measured, length error min/mean/max"
+             " %+.1f/%+.1f/%+.1fms (+-0.5ms), %lu over early\n",
+             pulse_stats.n, pulse_stats.min / 1e3,
+             pulse_stats.n ? pulse_stats.sum / pulse_stats.n / 1e3 : 0,
+             pulse_stats.max / 1e3, pulse_stats.early);
+}
+
+/* Wait for fd to become readable, handling guide pulse readbacks and
+ * ends meanwhile.  Returns -1 on poll () failure.
+ */
+static int
+lx200_wait (int fd)
+{
+    struct pollfd pfd[2];
+    int npfd, timeout;
+
+    pfd[0].fd = fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = pulse_tfd;
+    pfd[1].events = POLLIN;
+    npfd = pulse_tfd >= 0 ? 2 : 1;
+    for (;;) {
+        timeout = pulse_arm ();
+        if (poll (pfd, npfd, timeout) == -1) {
+            if (errno == EINTR)
+                continue;
+            if (debug)
+                perror ("poll");
+            return -1;
+        }
+#ifdef HAVE_TIMERFD
+        if (npfd == 2 && (pfd[1].revents & POLLIN)) {
+            uint64_t expirations;
+
+            if (read (pulse_tfd, &expirations, sizeof (expirations)) < 0
+                                                      && debug)
+                perror ("timerfd read");
+        }
+#endif
+        pulse_expire ();
+        if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR))
+            return 0;
+    }
+}
+
+/* Summarize base command latency and guide pulse errors on stderr, at
+ * most once per REPORT_SECS when there is something new (after every
+ * connection with -d).
+ */
+#define REPORT_SECS         60
+
+static void
+lx200_report (void)
+{
+    static double last = 0;
+    static unsigned long last_n = 0;
+    unsigned long n = base_lat.n + pulse_stats.n + pulse_stats.early;
+    double t = now_us ();
+
+    if (n == last_n || (!debug && t - last < REPORT_SECS * 1e6))
+        return;
+    base_latency_report ();
+    pulse_report ();
+    last = t;
+    last_n = n;
+}
+
 /* Ref: "Meade Telescope Serial Command Protocol, Revision L", 9 October 2002.
  * Emulate a subset of the LX200<16" ("classic") protocol.
  * TODO: only reached the point where the protocol subset used by the
- * two iphone apps is figured out.  No actual functionality yet!
+ * two iphone apps is figured out.  Slews move the mount (see base_buttons).
+ */
+static int flag = 0;
+
+/* Handle one '#' terminated command received at time t.
+ * Returns -1 if the connection failed.
+ */
+int lx200_cmd (int fd, char *buf, double t)
+{
+    int a, b, c;
+    float A, B;
+    char d;
+
+    if (debug)
+        fprintf (stderr, "R: %s\n",buf);
+    /* set current site latitude (sDD*MM) (resp: 0=invalid, 1=valid) */
+    if (sscanf (buf, ":St%d*%d#", &a, &b) == 2) {
+        if (send_str (fd, "1") == -1)
+            return -1;
+    /* set current site longitude (DDD*MM) (resp: 0=invalid, 1=valid) */
+    } else if (sscanf (buf, ":Sg%d*%d#", &a, &b) == 2) {
+        if (send_str (fd, "1") == -1)
+            return -1;
+    /* set UTC offset (sHH.H) (resp: 0=invalid, 1=valid) */
+    } else if (sscanf (buf, ":SG%f#", &A) == 1) {
+        if (send_str (fd, "1") == -1)
+            return -1;
+    /* set local time (HH:MM:SS) (resp: 0=invalid, 1=valid) */
+    } else if (sscanf (buf, ":SL%d:%d:%d#", &a, &b, &c) == 3) {
+        if (send_str (fd, "1") == -1)
+            return -1;
+    /* set handbox date (MM/DD/YY) (resp: 0#=invalid, 1str#=valid) */
+    } else if (sscanf (buf, ":SC%d/%d/%d#", &a, &b, &c) == 3) {
+        if (send_str (fd, "1#") == -1)
+            return -1;
+        flag = 1; /* SkySafari expects unsolicited str after reconnect */
+    /* get telescope RA (resp: HH:MM.T or HH:MM:SS) */
+    } else if (!strcmp (buf, ":GR#")) {
+        if (send_str (fd, "00:00:00#") == -1)
+            return -1;
+    /* set fast slew (resp: none) */
+    } else if (!strcmp (buf, ":RS#")) {
+        base_rate (RATE_SLEW, t);
+    /* set slew rate to find rate (2nd fastest) (resp: none) */
+    } else if (!strcmp (buf, ":RM#")) {
+        base_rate (RATE_FIND, t);
+    /* set slew rate to centering rate (2nd slowest) (resp: none) */
+    } else if (!strcmp (buf, ":RC#")) {
+        base_rate (RATE_CENTER, t);
+    /* set slew rate to guiding rate (slowest) (resp: none) */
+    } else if (!strcmp (buf, ":RG#")) {
+        base_rate (RATE_GUIDE, t);
+    /* get telescope product name (resp: str#) */
+    } else if (!strcmp (buf, ":GVP#")) {
+        if (send_str (fd, "ultima8drivecorrector#") == -1)
+            return -1;
+    /* get telescope DEC (resp: sDD*MM or sDD*MM'SS) */
+    } else if (!strcmp (buf, ":GD#")) {
+        if (send_str (fd, "+01*01'01#") == -1)
+            return -1;
+    /* set target object RA (HH:MM.T) (resp: 0=invalid, 1=valid) */
+    } else if (sscanf (buf, ":Sr%d:%f#", &a, &B) == 2) {
+        if (send_str (fd, "1") == -1)
+            return -1;
+    /* set target object RA (HH:MM:SS) (resp: 0=invalid, 1=valid) */
+    } else if (sscanf (buf, ":Sr%d:%d:%d#", &a, &b, &c) == 3) {
+        if (send_str (fd, "1") == -1)
+            return -1;
+    /* set target object DEC (sDD*MM) (resp: 0=invalid, 1=valid) */
+    } else if (sscanf (buf, ":Sd%d*%d#", &a, &b) == 2) {
+        if (send_str (fd, "1") == -1)
+            return -1;
+    /* set target object DEC (sDD*MM:SS) (resp: 0=invalid, 1=valid) */
+    } else if (sscanf (buf, ":Sd%d*%d:%d#", &a, &b, &c) == 3) {
+        if (send_str (fd, "1") == -1)
+            return -1;
+    /* slew to target object (resp: 0=valid, 1str#=below horiz,
+       2str#=below higher(?)) */
+    } else if (!strcmp (buf, ":MS#")) {
+        if (send_str (fd, "0") == -1)
+            return -1;
+        /* SkySafari will issue :GD# and :GR# until target is reached,
+           or :Q# if "stop" is pressed. */
+    /* sync telescope's position with currently selected db object
+       coordinates (resp: str#) */
+    } else if (!strcmp (buf, ":CM#")) {
+        if (send_str (fd, "happy fun object#") == -1)
+            return -1;
+    /* move east (:Q# to stop) at current slew rate (resp: none) */
+    } else if (!strcmp (buf, ":Me#")) {
+        pulse_cancel (axis_buttons[AXIS_RA], t);
+        move_done (MOVE_E, base_ra_move (BUTTON_EAST, t), t);
+    /* move west at current slew rate (resp: none) */
+    } else if (!strcmp (buf, ":Mw#")) {
+        pulse_cancel (axis_buttons[AXIS_RA], t);
+        move_done (MOVE_W, base_ra_move (BUTTON_WEST, t), t);
+    /* move north at current slew rate (resp: none) */
+    } else if (!strcmp (buf, ":Mn#")) {
+        pulse_cancel (axis_buttons[AXIS_DEC], t);
+        move_done (MOVE_N, base_buttons (BUTTON_NORTH, BUTTON_SOUTH, t), t);
+    /* move south at current slew rate (resp: none) */
+    } else if (!strcmp (buf, ":Ms#")) {
+        pulse_cancel (axis_buttons[AXIS_DEC], t);
+        move_done (MOVE_S, base_buttons (BUTTON_SOUTH, BUTTON_NORTH, t), t);
+    /* guide north/south/east/west for DDDD ms (resp: none) */
+    } else if (sscanf (buf, ":Mg%c%d#", &d, &a) == 2 && a >= 0
+                                                     && a <= 9999) {
+        switch (d) {
+            case 'n':
+                pulse_start (AXIS_DEC, BUTTON_NORTH, a, t);
+                break;
+            case 's':
+                pulse_start (AXIS_DEC, BUTTON_SOUTH, a, t);
+                break;
+            case 'e':
+                pulse_start (AXIS_RA, BUTTON_EAST, a, t);
+                break;
+            case 'w':
+                pulse_start (AXIS_RA, BUTTON_WEST, a, t);
+                break;
+        }
+    /* select sidereal tracking rate (resp: none) */
+    } else if (!strcmp (buf, ":TQ#")) {
+        base_track (TRACK_SIDEREAL, 0, t);
+    /* select lunar tracking rate (resp: none) */
+    } else if (!strcmp (buf, ":TL#")) {
+        base_track (TRACK_LUNAR, 0, t);
+    /* select solar tracking rate (resp: none) */
+    } else if (!strcmp (buf, ":TS#")) {
+        base_track (TRACK_SOLAR, 0, t);
+    /* select custom (manual) tracking rate (resp: none) */
+    } else if (!strcmp (buf, ":TM#")) {
+        base_track (TRACK_CUSTOM, track_custom_hz, t);
+    /* increment/decrement custom tracking rate by 0.1 Hz (resp: none) */
+    } else if (!strcmp (buf, ":T+#")) {
+        base_track (TRACK_CUSTOM, track_custom_hz + 0.1, t);
+    } else if (!strcmp (buf, ":T-#")) {
+        base_track (TRACK_CUSTOM, track_custom_hz - 0.1, t);
+    /* set custom tracking rate (TT.T Hz, 60.0=sidereal)
+       (resp: 0=invalid, 2=valid) */
+    } else if (sscanf (buf, ":ST%f#", &A) == 1) {
+        if (A < TRACK_MIN_HZ || A > TRACK_MAX_HZ) {
+            if (send_str (fd, "0") == -1)
+                return -1;
+        } else {
+            base_track (TRACK_CUSTOM, A, t);
+            if (send_str (fd, "2") == -1)
+                return -1;
+        }
+    /* get tracking rate (resp: TT.T#) */
+    } else if (!strcmp (buf, ":GT#")) {
+        char s[16];
+
+        snprintf (s, sizeof (s), "%04.1f#", track == TRACK_CUSTOM
+                                 ? track_custom_hz : track_hz[track]);
+        if (send_str (fd, s) == -1)
+            return -1;
+    /* halt all current slewing (resp: none) */
+    } else if (!strcmp (buf, ":Q#")) {
+        double done, ra;
+
+        pulse_cancel (BUTTON_NORTH | BUTTON_SOUTH | BUTTON_EAST
+                                   | BUTTON_WEST, t);
+        done = base_buttons (0, BUTTON_NORTH | BUTTON_SOUTH | BUTTON_EAST
+                                             | BUTTON_WEST, t);
+        ra = base_ra_move (0, t);
+        move_done (HALT, done < 0 ? done : ra, t);
+    /* halt east slew (resp: none) */
+    } else if (!strcmp (buf, ":Qe#")) {
+        pulse_cancel (BUTTON_EAST, t);
+        move_done (HALT_E, base_ra_move (ra_move & ~BUTTON_EAST, t), t);
+    /* halt west slew (resp: none) */
+    } else if (!strcmp (buf, ":Qw#")) {
+        pulse_cancel (BUTTON_WEST, t);
+        move_done (HALT_W, base_ra_move (ra_move & ~BUTTON_WEST, t), t);
+    /* halt north slew (resp: none) */
+    } else if (!strcmp (buf, ":Qn#")) {
+        pulse_cancel (BUTTON_NORTH, t);
+        move_done (HALT_N, base_buttons (0, BUTTON_NORTH, t), t);
+    /* halt south slew (resp: none) */
+    } else if (!strcmp (buf, ":Qs#")) {
+        pulse_cancel (BUTTON_SOUTH, t);
+        move_done (HALT_S, base_buttons (0, BUTTON_SOUTH, t), t);
+    } else {
+        if (debug)
+            fprintf (stderr, "unknown command\n");
+    }
+    return 0;
+}
+
+/* Commands may arrive several to a recv () (e.g. SkySafari's ":Q#:GD#")
+ * or split across them, so received bytes are buffered and each complete
+ * command handled in turn.  Guide pulses are followed while waiting.
  */
 void lx200_srv (int fd, int sfd)
 {
     ssize_t n;
     char buf[256];
-    static int flag = 0;
-    int a, b, c;
-    float A, B;
+    int len = 0;
+    char *cmd, *end;
+    double t;
 
     if (flag) {
         if (send_str (fd, "#") == -1)
             return;
         flag = 0;
     }
-
     do {
-        if ((n = recv (fd, buf, sizeof (buf) - 1, 0)) == -1) {
+        if (lx200_wait (fd) < 0)
+            break;
+        if ((n = recv (fd, buf + len, sizeof (buf) - 1 - len, 0)) == -1) {
             if (debug)
                 perror ("R: ");
             break;
@@ -217,113 +944,39 @@ void lx200_srv (int fd, int sfd)
                 fprintf (stderr, "R: EOF\n");
             break;
         }
-        /* special single char cmd */
-        if (n == 1 && buf[0] == 0x6) {
-            if (debug)
-                fprintf (stderr, "R: ACK\n");
-            if (send_str (fd, "P") == -1)
-                break;
-            continue;
-        }
-        buf[n] = '\0';
-        if (debug)
-            fprintf (stderr, "R: %s\n",buf);
-        /* set current site latitude (sDD*MM) (resp: 0=invalid, 1=valid) */
-        if (sscanf (buf, ":St%d*%d#", &a, &b) == 2) {
-            if (send_str (fd, "1") == -1)
-                break;
-        /* set current site longitude (DDD*MM) (resp: 0=invalid, 1=valid) */
-        } else if (sscanf (buf, ":Sg%d*%d#", &a, &b) == 2) {
-            if (send_str (fd, "1") == -1)
-                break;
-        /* set UTC offset (sHH.H) (resp: 0=invalid, 1=valid) */
-        } else if (sscanf (buf, ":SG%f#", &A) == 1) {
-            if (send_str (fd, "1") == -1)
-                break;
-        /* set local time (HH:MM:SS) (resp: 0=invalid, 1=valid) */
-        } else if (sscanf (buf, ":SL%d:%d:%d#", &a, &b, &c) == 3) {
-            if (send_str (fd, "1") == -1)
-                break;
-        /* set handbox date (MM/DD/YY) (resp: 0#=invalid, 1str#=valid) */
-        } else if (sscanf (buf, ":SC%d/%d/%d#", &a, &b, &c) == 3) {
-            if (send_str (fd, "1#") == -1)
-                break;
-            flag = 1; /* SkySafari expects unsolicited str after reconnect */
-        /* get telescope RA (resp: HH:MM.T or HH:MM:SS) */
-        } else if (!strcmp (buf, ":GR#")) {
-            if (send_str (fd, "00:00:00#") == -11)
-                break;
-        /* set fast slew (resp: none) */
-        } else if (!strcmp (buf, ":RS#")) {
-        /* set slew rate to find rate (2nd fastest) (resp: none) */
-        } else if (!strcmp (buf, ":RM#")) {
-        /* set slew rate to centering rate (2nd slowest) (resp: none) */
-        } else if (!strcmp (buf, ":RC#")) {
-        /* set slew rate to guiding rate (slowest) (resp: none) */
-        } else if (!strcmp (buf, ":RG#")) {
-        /* get telescope product name (resp: str#) */
-        } else if (!strcmp (buf, ":GVP#")) {
-            if (send_str (fd, "ultima8drivecorrector#") == -1)
-                break;
-        /* get telescope DEC (resp: sDD*MM or sDD*MM'SS) */
-        } else if (!strcmp (buf, ":GD#")) {
-            if (send_str (fd, "+01*01'01#") == -1)
-                break;
-        /* FIXME: combined halt, get DEC (skysafari) */
-        } else if (!strcmp (buf, ":Q#:GD#")) {
-            if (send_str (fd, "+01*01'01#") == -1)
-                break;
-        /* set target object RA (HH:MM.T) (resp: 0=invalid, 1=valid) */
-        } else if (sscanf (buf, ":Sr%d:%f#", &a, &B) == 2) {
-            if (send_str (fd, "1") == -1)
-                break;
-        /* set target object RA (HH:MM:SS) (resp: 0=invalid, 1=valid) */
-        } else if (sscanf (buf, ":Sr%d:%d:%d#", &a, &b, &c) == 3) {
-            if (send_str (fd, "1") == -1)
-                break;
-        /* set target object DEC (sDD*MM) (resp: 0=invalid, 1=valid) */
-        } else if (sscanf (buf, ":Sd%d*%d#", &a, &b) == 2) {
-            if (send_str (fd, "1") == -1)
-                break;
-        /* set target object DEC (sDD*MM:SS) (resp: 0=invalid, 1=valid) */
-        } else if (sscanf (buf, ":Sd%d*%d:%d#", &a, &b, &c) == 3) {
-            if (send_str (fd, "1") == -1)
-                break;
-        /* slew to target object (resp: 0=valid, 1str#=below horiz,
-           2str#=below higher(?)) */
-        } else if (!strcmp (buf, ":MS#")) {
-            if (send_str (fd, "0") == -1)
-                break;
-            /* SkySafari will issue :GD# and :GR# until target is reached,
-               or :Q# if "stop" is pressed. */
-        /* sync telescope's position with currently selected db object
-           coordinates (resp: str#) */
-        } else if (!strcmp (buf, ":CM#")) {
-            if (send_str (fd, "happy fun object#") == -1)
+        t = now_us ();
+        len += n;
+        buf[len] = '\0';
+        cmd = buf;
+        while (*cmd) {
+            /* special single char cmd */
+            if (cmd[0] == 0x6) {
+                if (debug)
+                    fprintf (stderr, "R: ACK\n");
+                if (send_str (fd, "P") == -1)
+                    goto done;
+                cmd++;
+                continue;
+            }
+            if (!(end = strchr (cmd, '#')))
                 break;
-        /* move east (:Q# to stop) at current slew rate (resp: none) */
-        } else if (!strcmp (buf, ":Me#")) {
-        /* move west at current slew rate (resp: none) */
-        } else if (!strcmp (buf, ":Mw#")) {
-        /* move north at current slew rate (resp: none) */
-        } else if (!strcmp (buf, ":Mn#")) {
-        /* move south at current slew rate (resp: none) */
-        } else if (!strcmp (buf, ":Ms#")) {
-        /* halt all current slewing (resp: none) */
-        } else if (!strcmp (buf, ":Q#")) {
-        /* halt east slew (resp: none) */
-        } else if (!strcmp (buf, ":Qe#")) {
-        /* halt west slew (resp: none) */
-        } else if (!strcmp (buf, ":Qw#")) {
-        /* halt north slew (resp: none) */
-        } else if (!strcmp (buf, ":Qn#")) {
-        /* halt south slew (resp: none) */
-        } else if (!strcmp (buf, ":Qs#")) {
-        } else {
-            if (debug)
-                fprintf (stderr, "unknown command\n");
+            *end = '\0';
+            {
+                char one[sizeof (buf) + 1];
+
+                snprintf (one, sizeof (one), "%s#", cmd);
+                if (lx200_cmd (fd, one, t) == -1)
+                    goto done;
+            }
+            cmd = end + 1;
         }
+        len = strlen (cmd);
+        if (len == sizeof (buf) - 1)
+            len = 0;                    /* no '#' in a full buffer */
+        memmove (buf, cmd, len);
     } while (1);
+done:
+    lx200_report ();
 }
 
 void *get_in_addr(struct sockaddr *sa)
@@ -412,7 +1065,7 @@ accept_connection (int sockfd)
 void usage (void)
 {
     fprintf (stderr,
-"Usage: netscope [-m lx200|enc] [-d] [-s serial_dev]\n"
+"Usage: netscope [-m lx200|enc] [-d] [-s serial_dev] [-b i2c_bus]\n"
     );
     exit (1);
 }
@@ -423,8 +1076,9 @@ int main(int argc, char *argv[])
     emumode_t mode = MODE_ENC; 
     int svc_fd, new_fd, sfd;
     char *devpath = "/dev/console";
+    char *buspath = "regd";
 
-    while ((c = getopt (argc, argv, "dm:s:")) != -1) {
+    while ((c = getopt (argc, argv, "dm:s:b:")) != -1) {
         switch (c) {
             case 'd':
                 debug = 1;
@@ -440,6 +1094,9 @@ int main(int argc, char *argv[])
             case 's':
                 devpath = optarg;
                 break;
+            case 'b':
+                buspath = optarg;
+                break;
             default:
                 usage ();
         }
@@ -450,9 +1107,16 @@ int main(int argc, char *argv[])
         exit (1);
     }
     serial_puts (sfd, "Ultima8 Netscope\n");
+    if (mode == MODE_LX200) {
+        base_open (buspath);
+        pulse_init ();
+    }
     svc_fd = setup_service ();
     for (;;) {
-        /* Sky Safari: reconnects for each command. */
+        /* Sky Safari: reconnects for each command, so guide pulses are
+         * followed between connections too. */
+        if (mode == MODE_LX200)
+            (void)lx200_wait (svc_fd);
         new_fd = accept_connection (svc_fd);
         switch (mode) {
             case MODE_ENC:
@@ -0,0 +1,129 @@
+/* regctl.c - read, write and benchmark base/aux I2C registers */
+
+/* ./regctl [-s bus] read <addr> <reg> [<n>]
+ * ./regctl [-s bus] write <addr> <reg> <val> ...
+ * ./regctl [-s bus] bench <addr> <reg> <n> <count>
+ * ./regctl [-s bus] stats
+ * The bus defaults to regd (see i2creg.h for bus specs).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "i2creg.h"
+
+static double
+now_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Time count burst reads; report transfer rate and latency.
+ */
+static void
+bench (i2creg_t *bus, int addr, int reg, int n, int count)
+{
+    uint16_t val[I2CREG_MAX_BURST];
+    double t0, t, dt, max = 0, start = now_us ();
+    int i;
+
+    for (i = 0; i < count; i++) {
+        t0 = now_us ();
+        if (i2creg_read (bus, addr, reg, val, n) < 0) {
+            perror ("read");
+            exit (1);
+        }
+        t = now_us ();
+        dt = t - t0;
+        if (dt > max)
+            max = dt;
+    }
+    t = now_us () - start;
+    printf ("%d reads of %d registers: %.0f reads/s,"
+            " latency mean %.1fus max %.1fus\n",
+            count, n, count / t * 1e6, t / count, max);
+}
+
+void
+usage (void)
+{
+    fprintf (stderr,
+"Usage: regctl [-s bus] read addr reg [n]\n"
+"       regctl [-s bus] write addr reg val...\n"
+"       regctl [-s bus] bench addr reg n count\n"
+"       regctl [-s bus] stats\n"
+    );
+    exit (1);
+}
+
+int
+main (int argc, char *argv[])
+{
+    const char *spec = "regd";
+    uint16_t val[I2CREG_MAX_BURST];
+    i2creg_t *bus;
+    char buf[256];
+    int c, i, n;
+
+    while ((c = getopt (argc, argv, "s:")) != -1) {
+        switch (c) {
+            case 's':
+                spec = optarg;
+                break;
+            default:
+                usage ();
+        }
+    }
+    argv += optind;
+    argc -= optind;
+    if (argc < 1)
+        usage ();
+    if (!(bus = i2creg_open (spec))) {
+        perror (spec);
+        exit (1);
+    }
+    if (!strcmp (argv[0], "read") && (argc == 3 || argc == 4)) {
+        n = argc == 4 ? strtol (argv[3], NULL, 0) : 1;
+        if (i2creg_read (bus, strtol (argv[1], NULL, 0),
+                         strtol (argv[2], NULL, 0), val, n) < 0) {
+            perror ("read");
+            exit (1);
+        }
+        for (i = 0; i < n; i++)
+            printf ("%s0x%04x", i > 0 ? " " : "", val[i]);
+        printf ("\n");
+    } else if (!strcmp (argv[0], "write") && argc >= 4
+                                   && argc - 3 <= I2CREG_MAX_BURST) {
+        for (i = 3; i < argc; i++)
+            val[i - 3] = strtoul (argv[i], NULL, 0);
+        if (i2creg_write (bus, strtol (argv[1], NULL, 0),
+                          strtol (argv[2], NULL, 0), val, argc - 3) < 0) {
+            perror ("write");
+            exit (1);
+        }
+    } else if (!strcmp (argv[0], "bench") && argc == 5) {
+        bench (bus, strtol (argv[1], NULL, 0), strtol (argv[2], NULL, 0),
+               strtol (argv[3], NULL, 0), strtol (argv[4], NULL, 0));
+    } else if (!strcmp (argv[0], "stats") && argc == 1) {
+        if (i2creg_stats (bus, buf, sizeof (buf)) < 0) {
+            perror ("stats");
+            exit (1);
+        }
+        printf ("%s\n", buf);
+    } else
+        usage ();
+    i2creg_close (bus);
+    exit (0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,472 @@
+/*****************************************************************************\
+ *  Copyright (C) 2012 Jim Garlick
+ *
+ *  This file is part of ultima8drivecorrector, replacement base electronics
+ *  for the Celestron Ultima 8 telescope.  For details, see
+ *  <http://code.google.com/p/ultima8drivecorrector>.
+ *
+ *  ultima8drivecorrector is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ultima8drivecorrector is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ *  Public License *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with ultima8drivecorrector; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* regd.c - own the I2C bus and share base/aux registers with local clients */
+
+/* Polled register ranges are read at their own rates.  Ranges on the same
+ * device that fall due together are merged into one burst read when they
+ * overlap or adjoin and fit, and any other polled range inside that burst
+ * is refreshed with it.  Clients connect to a unix socket and send one
+ * request per line:
+ *   r <addr> <reg> <n>         -> ok <val> ...
+ *   w <addr> <reg> <val> ...   -> ok
+ *   s                          -> ok <stats>
+ * or get "err <errno>".  A read inside a polled range is answered from
+ * the last poll, so clients add no bus traffic; other reads go to the
+ * bus.  A write goes to the bus, and polled ranges it touches are
+ * re-read at once.
+ *
+ * cc -o regd regd.c i2creg.c
+ * ./regd [-d] [-s bus] [-S socket] [-p addr:reg:n:ms]...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "i2creg.h"
+
+#define MAX_POLLS       16
+#define MAX_CLIENTS     16
+
+typedef struct {
+    int             addr, reg, n;
+    unsigned long   period;             /* ms */
+    unsigned long   next;               /* ms when due */
+    int             valid;
+    uint16_t        val[I2CREG_MAX_BURST];
+} poll_t;
+
+typedef struct {
+    int             fd;
+    char            buf[512];
+    int             n;
+} client_t;
+
+static poll_t polls[MAX_POLLS];
+static int npolls = 0;
+static client_t clients[MAX_CLIENTS];
+static int nclients = 0;
+
+static struct {
+    unsigned long   xfers;              /* bus transfers */
+    unsigned long   polled;             /* poll ranges refreshed */
+    unsigned long   hits;               /* client reads from polls */
+    unsigned long   misses;             /* client reads from the bus */
+    unsigned long   errors;             /* failed bus transfers */
+} stats;
+
+static const char *default_polls[] = {
+    "8:0:1:20",         /* base buttons */
+    "8:1:2:100",        /* base AC drive increment */
+    "9:0:3:20",         /* aux ra-enc, dec-enc, focus-enc */
+};
+
+static int debug = 0;
+
+static unsigned long
+now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+static int
+bus_read (i2creg_t *bus, int addr, int reg, uint16_t *val, int n)
+{
+    stats.xfers++;
+    if (i2creg_read (bus, addr, reg, val, n) < 0) {
+        stats.errors++;
+        if (debug)
+            fprintf (stderr, "read %d:%d:%d: %s\n", addr, reg, n,
+                     strerror (errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void
+add_poll (const char *s)
+{
+    poll_t *p = &polls[npolls];
+
+    if (npolls == MAX_POLLS) {
+        fprintf (stderr, "regd: too many polls\n");
+        exit (1);
+    }
+    if (sscanf (s, "%d:%d:%d:%lu", &p->addr, &p->reg, &p->n, &p->period) != 4
+                    || p->n < 1 || p->n > I2CREG_MAX_BURST || p->period < 1) {
+        fprintf (stderr, "regd: bad poll: %s\n", s);
+        exit (1);
+    }
+    p->next = 0;
+    p->valid = 0;
+    npolls++;
+}
+
+/* Read every due poll range, merging due ranges on one device that
+ * overlap or adjoin.  Ranges with a gap between them are read separately,
+ * so no register is read that no poll asked for (reads can have side
+ * effects, e.g. the base's pec-data).
+ */
+static void
+poll_run (i2creg_t *bus, unsigned long now)
+{
+    uint16_t val[I2CREG_MAX_BURST];
+    int batch[MAX_POLLS];
+    int i, j, lo, hi, ok, merged;
+
+    for (i = 0; i < npolls; i++) {
+        if (polls[i].next > now)
+            continue;
+        memset (batch, 0, sizeof (batch));
+        lo = polls[i].reg;
+        hi = polls[i].reg + polls[i].n;
+        batch[i] = 1;
+        do {
+            merged = 0;
+            for (j = i + 1; j < npolls; j++) {
+                poll_t *p = &polls[j];
+                int l = p->reg < lo ? p->reg : lo;
+                int h = p->reg + p->n > hi ? p->reg + p->n : hi;
+
+                if (!batch[j] && p->addr == polls[i].addr
+                              && p->next <= now
+                              && p->reg <= hi && p->reg + p->n >= lo
+                              && h - l <= I2CREG_MAX_BURST) {
+                    lo = l;
+                    hi = h;
+                    batch[j] = 1;
+                    merged = 1;
+                }
+            }
+        } while (merged);
+        for (j = 0; j < npolls; j++) {
+            poll_t *p = &polls[j];
+
+            if (p->addr == polls[i].addr && p->reg >= lo
+                                         && p->reg + p->n <= hi)
+                batch[j] = 1;
+        }
+        ok = (bus_read (bus, polls[i].addr, lo, val, hi - lo) == 0);
+        for (j = 0; j < npolls; j++) {
+            poll_t *p = &polls[j];
+
+            if (!batch[j])
+                continue;
+            p->valid = ok;
+            if (ok) {
+                memcpy (p->val, val + p->reg - lo, p->n * sizeof (uint16_t));
+                stats.polled++;
+            }
+            p->next = (p->next + p->period > now) ? p->next + p->period
+                                                  : now + p->period;
+        }
+    }
+}
+
+static int
+poll_timeout (unsigned long now)
+{
+    unsigned long next = now + 1000;
+    int i;
+
+    for (i = 0; i < npolls; i++)
+        if (polls[i].next < next)
+            next = polls[i].next;
+    return next > now ? next - now : 0;
+}
+
+static poll_t *
+poll_find (int addr, int reg, int n)
+{
+    int i;
+
+    for (i = 0; i < npolls; i++) {
+        poll_t *p = &polls[i];
+
+        if (p->valid && p->addr == addr && reg >= p->reg
+                                        && reg + n <= p->reg + p->n)
+            return p;
+    }
+    return NULL;
+}
+
+static void
+reply (client_t *c, const char *s)
+{
+    int len = strlen (s), n;
+
+    while (len > 0) {
+        if ((n = write (c->fd, s, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return;                     /* dropped on next read */
+        }
+        s += n;
+        len -= n;
+    }
+}
+
+static void
+reply_err (client_t *c, int err)
+{
+    char s[32];
+
+    snprintf (s, sizeof (s), "err %d\n", err);
+    reply (c, s);
+}
+
+static void
+reply_vals (client_t *c, const uint16_t *val, int n)
+{
+    char s[8 + I2CREG_MAX_BURST * 7];
+    int i, len;
+
+    len = snprintf (s, sizeof (s), "ok");
+    for (i = 0; i < n; i++)
+        len += snprintf (s + len, sizeof (s) - len, " %u", val[i]);
+    snprintf (s + len, sizeof (s) - len, "\n");
+    reply (c, s);
+}
+
+static void
+request (i2creg_t *bus, client_t *c, char *line)
+{
+    uint16_t val[I2CREG_MAX_BURST];
+    char *tok, *end;
+    int addr, reg, n, i;
+    poll_t *p;
+
+    if (debug)
+        fprintf (stderr, "%d: %s\n", c->fd, line);
+    if (!(tok = strtok (line, " \t"))) {
+        reply_err (c, EINVAL);
+    } else if (!strcmp (tok, "r")) {
+        tok = strtok (NULL, "");
+        if (!tok || sscanf (tok, "%d %d %d", &addr, &reg, &n) != 3
+                  || n < 1 || n > I2CREG_MAX_BURST) {
+            reply_err (c, EINVAL);
+        } else if ((p = poll_find (addr, reg, n))) {
+            stats.hits++;
+            reply_vals (c, p->val + reg - p->reg, n);
+        } else {
+            stats.misses++;
+            if (bus_read (bus, addr, reg, val, n) < 0)
+                reply_err (c, errno);
+            else
+                reply_vals (c, val, n);
+        }
+    } else if (!strcmp (tok, "w")) {
+        addr = (tok = strtok (NULL, " \t")) ? strtol (tok, NULL, 0) : -1;
+        reg = (tok = strtok (NULL, " \t")) ? strtol (tok, NULL, 0) : -1;
+        for (n = 0; n < I2CREG_MAX_BURST && (tok = strtok (NULL, " \t"));
+                                                                    n++) {
+            val[n] = strtoul (tok, &end, 0);
+            if (*end != '\0')
+                break;
+        }
+        if (tok && n < I2CREG_MAX_BURST) {
+            reply_err (c, EINVAL);
+        } else if (stats.xfers++, i2creg_write (bus, addr, reg, val, n) < 0) {
+            stats.errors++;
+            reply_err (c, errno);
+        } else {
+            for (i = 0; i < npolls; i++) {
+                p = &polls[i];
+                if (p->addr == addr && reg < p->reg + p->n
+                                    && reg + n > p->reg)
+                    p->next = 0;        /* re-read at once */
+            }
+            reply (c, "ok\n");
+        }
+    } else if (!strcmp (tok, "s")) {
+        char s[160];
+
+        snprintf (s, sizeof (s), "ok xfers=%lu polled=%lu hits=%lu"
+                  " misses=%lu errors=%lu\n", stats.xfers, stats.polled,
+                  stats.hits, stats.misses, stats.errors);
+        reply (c, s);
+    } else {
+        reply_err (c, EINVAL);
+    }
+}
+
+/* Returns -1 if the client should be dropped.
+ */
+static int
+client_input (i2creg_t *bus, client_t *c)
+{
+    char *nl, *line;
+    int n;
+
+    n = read (c->fd, c->buf + c->n, sizeof (c->buf) - 1 - c->n);
+    if (n <= 0)
+        return (n < 0 && errno == EINTR) ? 0 : -1;
+    c->n += n;
+    line = c->buf;
+    while ((nl = memchr (line, '\n', c->n - (line - c->buf)))) {
+        *nl = '\0';
+        request (bus, c, line);
+        line = nl + 1;
+    }
+    c->n -= line - c->buf;
+    memmove (c->buf, line, c->n);
+    if (c->n == sizeof (c->buf) - 1)
+        return -1;                      /* line too long */
+    return 0;
+}
+
+static int
+setup_socket (const char *path)
+{
+    struct sockaddr_un sun;
+    int fd;
+
+    if (strlen (path) >= sizeof (sun.sun_path)) {
+        fprintf (stderr, "regd: socket path too long\n");
+        exit (1);
+    }
+    if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror ("socket");
+        exit (1);
+    }
+    memset (&sun, 0, sizeof (sun));
+    sun.sun_family = AF_UNIX;
+    strcpy (sun.sun_path, path);
+    unlink (path);
+    if (bind (fd, (struct sockaddr *)&sun, sizeof (sun)) < 0) {
+        perror (path);
+        exit (1);
+    }
+    if (listen (fd, MAX_CLIENTS) < 0) {
+        perror ("listen");
+        exit (1);
+    }
+    return fd;
+}
+
+void
+usage (void)
+{
+    fprintf (stderr,
+"Usage: regd [-d] [-s bus] [-S socket] [-p addr:reg:n:ms]...\n"
+    );
+    exit (1);
+}
+
+int
+main (int argc, char *argv[])
+{
+    const char *spec = "/dev/i2c-0";
+    const char *path = I2CREG_REGD_SOCK;
+    struct pollfd pfd[1 + MAX_CLIENTS];
+    i2creg_t *bus;
+    int c, i, lfd;
+
+    while ((c = getopt (argc, argv, "ds:S:p:")) != -1) {
+        switch (c) {
+            case 'd':
+                debug = 1;
+                break;
+            case 's':
+                spec = optarg;
+                break;
+            case 'S':
+                path = optarg;
+                break;
+            case 'p':
+                add_poll (optarg);
+                break;
+            default:
+                usage ();
+        }
+    }
+    if (optind != argc)
+        usage ();
+    if (npolls == 0)
+        for (i = 0; i < sizeof (default_polls) / sizeof (char *); i++)
+            add_poll (default_polls[i]);
+    if (!strncmp (spec, "regd", 4)) {
+        fprintf (stderr, "regd: bus cannot be regd\n");
+        exit (1);
+    }
+    if (!(bus = i2creg_open (spec))) {
+        perror (spec);
+        exit (1);
+    }
+    signal (SIGPIPE, SIG_IGN);
+    lfd = setup_socket (path);
+
+    for (;;) {
+        poll_run (bus, now_ms ());
+
+        pfd[0].fd = lfd;
+        pfd[0].events = POLLIN;
+        for (i = 0; i < nclients; i++) {
+            pfd[1 + i].fd = clients[i].fd;
+            pfd[1 + i].events = POLLIN;
+        }
+        if (poll (pfd, 1 + nclients, poll_timeout (now_ms ())) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror ("poll");
+            exit (1);
+        }
+        for (i = nclients - 1; i >= 0; i--) {
+            if (!pfd[1 + i].revents)
+                continue;
+            if (client_input (bus, &clients[i]) < 0) {
+                close (clients[i].fd);
+                clients[i] = clients[--nclients];
+            }
+        }
+        if (pfd[0].revents & POLLIN) {
+            int fd = accept (lfd, NULL, NULL);
+
+            if (fd >= 0 && nclients == MAX_CLIENTS) {
+                close (fd);
+            } else if (fd >= 0) {
+                clients[nclients].fd = fd;
+                clients[nclients].n = 0;
+                nclients++;
+            }
+        }
+    }
+
+    i2creg_close (bus);
+    return 0;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,38 @@
+/* simbus.c - I2C bus with the base and aux firmware simulated in-process */
+
+/* Each firmware image is linked with simpic.c into basefw.o and auxfw.o
+ * (see Makefile), which export only their simpic functions.  Transfers
+ * go to the image at the matching address; others are not ACKed.
+ */
+
+#include <stdint.h>
+
+#include "simpic.h"
+#include "i2creg.h"
+
+SIMPIC_DECLARE(base)
+SIMPIC_DECLARE(aux)
+
+int
+simbus_start (int realtime)
+{
+    if (base_simpic_start (realtime) < 0 || aux_simpic_start (realtime) < 0)
+        return -1;
+    return 0;
+}
+
+int
+simbus_xfer (int addr, const uint8_t *w, int wlen, uint8_t *r, int rlen)
+{
+    switch (addr) {
+        case I2CREG_BASE_ADDR:
+            return base_simpic_xfer (addr, w, wlen, r, rlen);
+        case I2CREG_AUX_ADDR:
+            return aux_simpic_xfer (addr, w, wlen, r, rlen);
+    }
+    return -1;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */